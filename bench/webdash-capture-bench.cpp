@@ -0,0 +1,81 @@
+#include "webdash-capture.hpp"
+#include "webdash-core.hpp"
+#include "webdash-process.hpp"
+#include "webdash-supervisor.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <memory>
+#include <string>
+#include <unistd.h>
+
+using namespace std;
+
+const string _WEBDASH_PROJECT_NAME_ = "webdash-capture-bench";
+
+/**
+ *
+ * Throughput of capturing the output of an action: {size} MiB are piped through
+ * `head -c`, collected into the RunReturn, spliced into a file sink, and kept in a
+ * ring buffer sink.
+ *
+ * Usage: webdash-capture-bench [size MiB, default 300]
+ *
+ * */
+namespace {
+    // Runs the action to completion. Returns the seconds it took.
+    double Capture(size_t size, bool collect_output, std::shared_ptr<webdash::OutputSink> sink) {
+        const string count = to_string(size);
+
+        webdash::LaunchSpec spec;
+        spec.command = webdash::Command::FromArgv({ "head", "-c", count, "/dev/zero" }, "head -c " + count + " /dev/zero");
+
+        std::promise<webdash::RunReturn> done;
+        const auto start = std::chrono::steady_clock::now();
+
+        const uint64_t id = WebDashSupervisor::Get().Launch({ spec }, collect_output, sink, "capture", nullopt,
+            [&](webdash::RunReturn ret) { done.set_value(std::move(ret)); });
+        if (id == 0) {
+            perror("launch");
+            exit(1);
+        }
+
+        const webdash::RunReturn ret = done.get_future().get();
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+
+        if (ret.return_code != 0 || (collect_output && ret.output.size() != size)) {
+            fprintf(stderr, "capture failed: return code %d, %zu bytes\n", ret.return_code, ret.output.size());
+            exit(1);
+        }
+
+        return std::chrono::duration<double>(elapsed).count();
+    }
+}
+
+int main(int argc, char** argv) {
+    const size_t size_mib = argc > 1 ? strtoull(argv[1], nullptr, 10) : 300;
+    const size_t size = size_mib << 20;
+
+    char sink_path[] = "/tmp/webdash-capture-bench-XXXXXX";
+    const int sink_fd = mkstemp(sink_path);
+    if (sink_fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(sink_fd);
+
+    const auto report = [&](const char* mode, double seconds) {
+        printf("%-12s %8.3f s %10.1f MiB/s\n", mode, seconds, size_mib / seconds);
+    };
+
+    printf("Capturing %zu MiB\n", size_mib);
+    report("collect", Capture(size, true, nullptr));
+    report("file sink", Capture(size, false, std::make_shared<webdash::FileSink>(sink_path)));
+    report("ring buffer", Capture(size, false, std::make_shared<webdash::RingBufferSink>(1 << 20)));
+
+    unlink(sink_path);
+
+    return 0;
+}
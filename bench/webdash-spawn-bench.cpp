@@ -0,0 +1,90 @@
+#include "webdash-core.hpp"
+#include "webdash-process.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+const string _WEBDASH_PROJECT_NAME_ = "webdash-spawn-bench";
+
+/**
+ *
+ * Latency of starting and reaping a trivial child, webdash::Spawn against fork() + exec,
+ * with parent heaps of different sizes. fork() copies the page tables of the whole heap,
+ * Spawn() must not depend on it.
+ *
+ * Usage: webdash-spawn-bench [heap MiB ...]
+ *
+ * */
+namespace {
+    constexpr int kIterations = 200;
+
+    const char* const kProgram = "true";
+
+    double Measure(const std::function<pid_t()>& spawn) {
+        const auto start = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < kIterations; ++i) {
+            const pid_t pid = spawn();
+            if (pid < 0) {
+                perror("spawn");
+                exit(1);
+            }
+
+            while (waitpid(pid, nullptr, 0) == -1 && errno == EINTR) {}
+        }
+
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double, std::micro>(elapsed).count() / kIterations;
+    }
+
+    pid_t ForkExec() {
+        const pid_t pid = fork();
+        if (pid == 0) {
+            execlp(kProgram, kProgram, (char*)nullptr);
+            _exit(127);
+        }
+
+        return pid;
+    }
+}
+
+int main(int argc, char** argv) {
+    vector<size_t> heap_sizes_mib = { 0, 256, 1024 };
+    if (argc > 1) {
+        heap_sizes_mib.clear();
+        for (int i = 1; i < argc; ++i)
+            heap_sizes_mib.push_back(strtoull(argv[i], nullptr, 10));
+    }
+
+    webdash::LaunchSpec spec;
+    spec.command = webdash::Command::FromArgv({ kProgram }, kProgram);
+
+    printf("%10s %14s %14s\n", "heap MiB", "Spawn us", "fork+exec us");
+
+    for (size_t heap_mib : heap_sizes_mib) {
+        // Touched, so that the pages are actually mapped.
+        const size_t heap_size = heap_mib << 20;
+        char* heap = (char*)malloc(heap_size + 1);
+        memset(heap, 1, heap_size + 1);
+
+        const double spawn_us = Measure([&]() { return webdash::Spawn(spec); });
+        const double fork_us = Measure(ForkExec);
+
+        printf("%10zu %14.1f %14.1f\n", heap_mib, spawn_us, fork_us);
+
+        free(heap);
+    }
+
+    return 0;
+}
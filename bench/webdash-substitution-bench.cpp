@@ -0,0 +1,119 @@
+#include "webdash-core.hpp"
+#include "webdash-substitutions.hpp"
+#include "webdash-utils.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+const string _WEBDASH_PROJECT_NAME_ = "webdash-substitution-bench";
+
+/**
+ *
+ * Expanding action templates with webdash::Substitutions against the former approach of
+ * one find-and-replace pass per definition (SubstituteKeywords for every key).
+ *
+ * The definitions are those of the myworld at {root} if given, otherwise a generated set
+ * shaped like a definitions.json of 100 projects.
+ *
+ * Usage: webdash-substitution-bench [root]
+ *
+ * */
+namespace {
+    constexpr int kProjects = 100;
+    constexpr int kTemplates = 4000;
+
+    string ExpandPerDefinition(string text, const vector<pair<string, string>>& definitions) {
+        for (const auto& [key, value] : definitions)
+            text = SubstituteKeywords(text, key, value);
+        return text;
+    }
+
+    vector<pair<string, string>> GenerateDefinitions() {
+        vector<pair<string, string>> definitions = { { "$#.myworld.rootDir", "this" } };
+
+        for (int i = 0; i < kProjects; ++i) {
+            const string key = "$#.projects.p" + to_string(i);
+            definitions.push_back({ key + ".dir", "/home/user/myworld/projects/p" + to_string(i) });
+            definitions.push_back({ key + ".build", "make -C p" + to_string(i) });
+            definitions.push_back({ key + ".flags.[0]", "-O2" });
+            definitions.push_back({ key + ".flags.[1]", "-g" });
+            definitions.push_back({ key + ".name", "project-" + to_string(i) });
+        }
+
+        definitions.push_back({ "$.rootDir()", "/home/user/myworld" });
+        definitions.push_back({ "$.thisDir()", "/home/user/myworld/projects/p1" });
+
+        return definitions;
+    }
+
+    // Half of them reference definitions, like actions and working directories of a config.
+    vector<string> GenerateTemplates(const vector<pair<string, string>>& definitions) {
+        vector<string> templates;
+        std::mt19937 rng(1);
+
+        for (int i = 0; i < kTemplates / 2; ++i) {
+            const string& a = definitions[rng() % definitions.size()].first;
+            const string& b = definitions[rng() % definitions.size()].first;
+
+            templates.push_back("cd " + a + " && " + b + " OUT=$.thisDir()/out/" + to_string(i) + " --log $.rootDir()/app-temporary/build.log");
+            templates.push_back("echo plain action number " + to_string(i) + " without any placeholders");
+        }
+
+        return templates;
+    }
+
+    template <typename Function>
+    double MeasureMs(Function function) {
+        const auto start = std::chrono::steady_clock::now();
+        function();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+}
+
+int main(int argc, char** argv) {
+    vector<pair<string, string>> definitions;
+    if (argc > 1) {
+        WebDashCore::Create(string(argv[1]));
+        definitions = MyWorld().GetCoreDefinitions();
+        for (auto& definition : MyWorld().GetCustomDefinitions())
+            definitions.push_back(std::move(definition));
+    } else {
+        definitions = GenerateDefinitions();
+    }
+
+    const vector<string> templates = GenerateTemplates(definitions);
+
+    size_t mismatches = 0;
+    size_t total = 0;
+
+    const double per_definition_ms = MeasureMs([&]() {
+        for (const string& text : templates)
+            total += ExpandPerDefinition(text, definitions).size();
+    });
+
+    webdash::Substitutions substitutions;
+    const double compile_ms = MeasureMs([&]() { substitutions = webdash::Substitutions(definitions); });
+
+    vector<string> expanded;
+    const double single_pass_ms = MeasureMs([&]() {
+        for (const string& text : templates)
+            expanded.push_back(substitutions.Apply(text));
+    });
+
+    // Can differ where keys overlap or refer to each other: the longest key wins, and references
+    // resolve regardless of the order of the definitions.
+    for (size_t i = 0; i < templates.size(); ++i)
+        mismatches += expanded[i] != ExpandPerDefinition(templates[i], definitions);
+
+    printf("%zu definitions, %zu templates (%zu bytes expanded)\n", definitions.size(), templates.size(), total);
+    printf("per definition:  %10.2f ms\n", per_definition_ms);
+    printf("single pass:     %10.2f ms (+ %.2f ms compiling)\n", single_pass_ms, compile_ms);
+    printf("differing results: %zu\n", mismatches);
+
+    return 0;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include "webdash-types.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+/**
+ *
+ * Content-addressed cache of task results, kept in GetPersistenteStoragePath()/action-cache.
+ *
+ * An entry is keyed by a hash of everything the actions depend on (see WebDashConfigTask::GetCacheKey)
+ * and holds the captured output, the return code, and copies of the declared output files.
+ * On a hit the files are restored and the output is replayed without spawning anything.
+ *
+ * Entries are evicted least recently used first once the cache grows beyond its size bound.
+ * The index is shared by all processes: every change re-reads it under a file lock, and it
+ * is replaced atomically. Entry directories missing from it are adopted, so they still count.
+ *
+ * */
+class WebDashActionCache {
+    public:
+        static WebDashActionCache& Get();
+
+        WebDashActionCache(const WebDashActionCache&) = delete;
+
+        // Restores the output files of entry {key} (unless {restore_files} is false) and returns its
+        // result, or nullopt on a miss.
+        std::optional<webdash::RunReturn> Restore(uint64_t key, bool restore_files = true);
+
+        // Stores {result} and the files {outputs} as entry {key}. Least recently used entries are
+        // evicted until the cache takes at most {capacity} bytes.
+        void Store(uint64_t key, const webdash::RunReturn& result, const vector<string>& outputs, uint64_t capacity);
+
+    private:
+        WebDashActionCache() = default;
+
+        struct Entry {
+            uint64_t size = 0;
+
+            // Milliseconds since epoch.
+            int64_t last_used = 0;
+        };
+
+        // The methods below require _mutex to be held.
+
+        // The cache directory, created on first use.
+        std::filesystem::path _GetRoot();
+
+        // Re-reads the index. Requires the index lock to be held.
+        void _Load();
+
+        // Indexes entry directories the index lacks and removes leftovers. Returns true iff anything changed.
+        bool _Adopt();
+
+        // Requires the index lock to be held.
+        void _Save();
+
+        void _Evict(uint64_t capacity);
+
+        std::filesystem::path _GetEntryPath(const string& key) const;
+
+        // Set once the entry directories were reconciled with the index.
+        bool _is_loaded = false;
+
+        std::filesystem::path _root;
+
+        unordered_map<string, Entry> _entries;
+
+        uint64_t _total_size = 0;
+
+        std::mutex _mutex;
+};
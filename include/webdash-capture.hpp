@@ -0,0 +1,153 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "webdash-types.hpp"
+
+using namespace std;
+
+namespace webdash {
+    class FileSink;
+
+    /**
+     *
+     * Receives the output of actions chunk by chunk, as it arrives, tagged with the id of the
+     * task and the stream that produced it. Nothing is accumulated on the way.
+     *
+     * Write() may be called concurrently by executor workers.
+     *
+     * */
+    class OutputSink {
+        public:
+            virtual ~OutputSink() = default;
+
+            virtual void Write(const string& taskid, Stream stream, const char* data, size_t len) = 0;
+
+            // File sinks get the data spliced straight from the pipe, bypassing Write().
+            virtual FileSink* AsFileSink() { return nullptr; }
+    };
+
+    // Forwards every chunk to a callback. The callback must be thread-safe if jobs > 1.
+    class CallbackSink : public OutputSink {
+        public:
+            using Callback = std::function<void(const string& taskid, Stream stream, const char* data, size_t len)>;
+
+            CallbackSink(Callback callback) : _callback(callback) {}
+
+            void Write(const string& taskid, Stream stream, const char* data, size_t len) override {
+                _callback(taskid, stream, data, len);
+            }
+
+        private:
+            Callback _callback;
+    };
+
+    /**
+     *
+     * File receiving the output of all actions of a run. Task ids and streams are not recorded.
+     *
+     * Several actions may write concurrently. Each chunk reserves its byte range atomically
+     * and is then spliced to that offset, so the data never passes through user space and
+     * chunks of different actions never overwrite each other.
+     *
+     * */
+    class FileSink : public OutputSink {
+        public:
+            // Opens (creates) {path}. New output is appended to existing content.
+            FileSink(const string& path);
+
+            FileSink(const FileSink&) = delete;
+
+            ~FileSink();
+
+            void Write(const string& taskid, Stream stream, const char* data, size_t len) override;
+
+            FileSink* AsFileSink() override { return this; }
+
+            bool IsOpen() const { return _fd >= 0; }
+
+            int GetFd() const { return _fd; }
+
+            // Reserves {len} bytes at the end of the file. Returns the offset to write to.
+            off_t Reserve(size_t len) { return _offset.fetch_add(len); }
+
+        private:
+            int _fd = -1;
+
+            std::atomic<off_t> _offset;
+    };
+
+    // Keeps only the last {capacity} bytes of output.
+    class RingBufferSink : public OutputSink {
+        public:
+            RingBufferSink(size_t capacity);
+
+            void Write(const string& taskid, Stream stream, const char* data, size_t len) override;
+
+            // Returns the retained output, oldest byte first.
+            string GetContents();
+
+            // Total number of bytes written, including dropped ones.
+            size_t GetTotalSize();
+
+        private:
+            vector<char> _buffer;
+
+            // Position of the next byte to write.
+            size_t _head = 0;
+
+            size_t _total = 0;
+
+            std::mutex _mutex;
+    };
+
+    // Enlarges the pipe buffer of {fd} (best effort) so that verbose children need fewer wake-ups.
+    void EnlargePipe(int fd);
+
+    /**
+     *
+     * Captures one output stream of a child from the read end of a non-blocking pipe.
+     *
+     * Data goes to RunReturn::output (with an OutputChunk per read) and/or the sink. If only
+     * a FileSink wants the data, it is spliced into the file without passing user space.
+     *
+     * */
+    class PipeCapture {
+        public:
+            enum class Status {
+                Open,
+                Eof,
+                Error
+            };
+
+            PipeCapture(int fd, Stream stream, RunReturn* ret, OutputSink* sink, const string& taskid);
+
+            // Consumes what is currently buffered in the pipe, at most {budget} bytes.
+            Status Pump(size_t budget);
+
+            int GetFd() const { return _fd; }
+
+        private:
+            Status _Read(size_t budget);
+
+            Status _Splice(size_t budget);
+
+            int _fd;
+
+            Stream _stream;
+
+            RunReturn* _ret;
+
+            OutputSink* _sink;
+
+            FileSink* _file;
+
+            string _taskid;
+    };
+}
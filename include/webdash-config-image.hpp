@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace webdash {
+    // Bumped whenever the layout of config images changes. Images of other versions are ignored.
+    constexpr uint32_t kConfigImageVersion = 2;
+
+    // Serializes values for a config image (see WebDashConfig::Compile). Little endian,
+    // strings and lists prefixed by their 32-bit length.
+    class ImageWriter {
+        public:
+            void PutU32(uint32_t value);
+
+            void PutU64(uint64_t value);
+
+            void PutBool(bool value) { PutU32(value ? 1 : 0); }
+
+            void PutString(const string& value);
+
+            void PutStrings(const vector<string>& values);
+
+            void PutOptionalString(const std::optional<string>& value);
+
+            const string& GetData() const { return _data; }
+
+        private:
+            string _data;
+    };
+
+    // Reads what ImageWriter wrote, from memory it doesn't own (usually a mapped file).
+    // Every read throws std::out_of_range if the data ends early.
+    class ImageReader {
+        public:
+            ImageReader(const char* data, size_t size) : _data(data), _size(size) {}
+
+            uint32_t GetU32();
+
+            uint64_t GetU64();
+
+            bool GetBool() { return GetU32() != 0; }
+
+            string GetString();
+
+            vector<string> GetStrings();
+
+            std::optional<string> GetOptionalString();
+
+            // The bytes not read yet.
+            const char* GetRemaining() const { return _data + _offset; }
+
+            size_t GetRemainingSize() const { return _size - _offset; }
+
+        private:
+            const char* _Take(size_t len);
+
+            const char* _data;
+
+            size_t _size;
+
+            size_t _offset = 0;
+    };
+}
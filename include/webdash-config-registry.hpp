@@ -0,0 +1,74 @@
+#pragma once
+
+#include <ctime>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+using namespace std;
+
+class WebDashConfig;
+
+namespace WebDash {
+    struct Definitions;
+}
+
+/**
+ *
+ * Process-wide cache of loaded configs, keyed by canonical path, so that tasks referencing
+ * other configs ("<config path>:<task_name>") don't re-read and re-parse them every time.
+ *
+ * Every lookup stats the file: a config whose file changed (mtime, inode or size), or loaded
+ * with definitions that changed since, is loaded anew. Configs are handed out as shared pointers, so a replaced config, and its tasks,
+ * lives on as long as somebody still uses it.
+ *
+ * Lookups of cached configs only take a shared lock and may run concurrently.
+ *
+ * */
+class WebDashConfigRegistry {
+    public:
+        static WebDashConfigRegistry& Get();
+
+        WebDashConfigRegistry(const WebDashConfigRegistry&) = delete;
+
+        // Returns the config at {path}, loading it if needed. nullptr if there is no such file or it
+        // failed to load.
+        std::shared_ptr<WebDashConfig> Find(const string& path);
+
+    private:
+        WebDashConfigRegistry() = default;
+
+        // Identifies a version of a file, and of the definitions it was loaded with.
+        struct Signature {
+            dev_t device;
+            ino_t inode;
+            off_t size;
+            timespec mtime;
+
+            // Held, so that a new snapshot never reuses its address.
+            std::shared_ptr<const WebDash::Definitions> definitions;
+
+            bool operator==(const Signature& other) const {
+                return device == other.device && inode == other.inode && size == other.size &&
+                       mtime.tv_sec == other.mtime.tv_sec && mtime.tv_nsec == other.mtime.tv_nsec &&
+                       definitions == other.definitions;
+            }
+        };
+
+        struct Entry {
+            Signature signature;
+
+            // nullptr if loading failed.
+            std::shared_ptr<WebDashConfig> config;
+        };
+
+        // Path as given -> canonical path. Saves resolving the same path over and over.
+        unordered_map<string, string> _canonical_paths;
+
+        unordered_map<string, Entry> _entries;
+
+        std::shared_mutex _mutex;
+};
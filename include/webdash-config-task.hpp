@@ -1,10 +1,15 @@
 #pragma once
 
 #include <chrono>
+#include <memory>
+#include <mutex>
 
 #include <nlohmann/json.hpp>
 
-#include "webdash-config-task.hpp"
+#include "webdash-config-image.hpp"
+#include "webdash-process.hpp"
+#include "webdash-schedule.hpp"
+#include "webdash-task-handle.hpp"
 #include "webdash-types.hpp"
 
 class WebDashConfig;
@@ -21,26 +26,115 @@ class WebDashConfigTask {
     public:
         WebDashConfigTask(WebDashConfig*, string, json);
 
+        // Restores a task written by WriteImage. Throws std::out_of_range on truncated data.
+        WebDashConfigTask(WebDashConfig* config, webdash::ImageReader& reader);
+
+        // Writes what was parsed from the config, substitutions applied, for WebDashConfig::Compile.
+        void WriteImage(webdash::ImageWriter& writer) const;
+
         bool ShouldExecuteTimewise(webdash::RunConfig config);
 
+        // When the task is due next according to its frequency. In the past if it is due already.
+        std::chrono::system_clock::time_point GetNextDue();
+
+        const webdash::Schedule& GetSchedule() const { return _schedule; }
+
+        // Makes {run} the task's run in flight. If another run is still in flight (e.g. of the scheduler
+        // running a dependency shared by two due tasks), returns that one's handle instead: it is to be
+        // waited for rather than running the task concurrently.
+        std::optional<webdash::TaskHandle> Claim(webdash::TaskHandle run);
+
+        // Marks the beginning of a run. Returns false iff the task is to be skipped (see ShouldExecuteTimewise).
+        bool BeginRun(webdash::RunConfig config);
+
+        // Marks the end of a run started by BeginRun.
+        void EndRun(const webdash::RunReturn& result);
+
         webdash::RunReturn Run(webdash::RunConfig config, std::string action);
 
+        // Starts {action} and returns right away. The handle completes once the process exited.
+        webdash::TaskHandle RunAsync(webdash::RunConfig config, std::string action);
+
+        webdash::TaskHandle RunAsync(webdash::RunConfig config, const webdash::Pipeline& pipeline);
+
         webdash::RunReturn Run(webdash::RunConfig config = {});
 
-        string GetName() { return _name; }
+        // Starts the task (dependencies and actions) and returns right away.
+        // The task object must outlive the returned handle's completion.
+        webdash::TaskHandle RunAsync(webdash::RunConfig config = {});
+
+        string GetName() const { return _name; }
+
+        string GetTaskId() const { return _taskid; }
+
+        const vector<string>& GetDependencies() const { return _dependencies; }
+
+        const vector<string>& GetActions() const { return _actions; }
+
+        // The actions, split into arguments. Same order as GetActions().
+        const vector<webdash::Pipeline>& GetCommands() const { return _commands; }
+
+        bool IsFailFast() const { return _fail_fast; }
+
+        // True iff the task declares inputs or outputs.
+        bool HasFingerprints() const { return !_inputs.empty() || !_outputs.empty(); }
+
+        // True iff the task declares inputs/outputs and none of them changed since its last successful run.
+        bool IsUpToDate() const;
+
+        // Key of the task's entry in the action cache: a hash of the resolved actions, working directory,
+        // environment additions and contents of all inputs. nullopt if the task doesn't use the cache.
+        std::optional<uint64_t> GetCacheKey() const;
+
+        // The files matched by the declared outputs.
+        vector<string> GetOutputFiles() const;
+
+        // Remembers the state of inputs and outputs after a run. Failed runs are forgotten.
+        void UpdateFingerprints(const webdash::RunReturn& result) const;
 
         bool IsValid() { return _is_valid; }
+
+        // Hash of the task's entry in the config, as written (before substitutions).
+        uint64_t GetSourceHash() const { return _source_hash; }
+
+        // The definitions (keys) the task's fields were substituted with, directly or through other definitions.
+        const vector<string>& GetReferencedDefinitions() const { return _referenced_definitions; }
+
+        // Used when the "env" definitions changed (see WebDashConfig::Reload).
+        void SetEnvironment(std::shared_ptr<const webdash::Environment> environment) { _environment = environment; }
     private:
+        uint64_t _GetDefinitionHash() const;
+
+        // Requires _run_mutex to be held.
+        void _LoadRunState();
+
+        // ShouldExecuteTimewise. Requires _run_mutex to be held.
+        bool _IsDue(const webdash::RunConfig& config);
 
         string _taskid;
         std::optional<string> _frequency;
+        webdash::Schedule _schedule;
         vector<string> _actions;
+
+        // Command lines of each action's stages: one, or several for a pipeline.
+        vector<vector<string>> _action_stages;
+
+        vector<webdash::Pipeline> _commands;
+        std::shared_ptr<const webdash::Environment> _environment;
         vector<string> _dependencies;
         string _name;
         std::optional<string> _wdir;
 
-        // Per default, ::time_point is initialized to epoch.
-        std::chrono::high_resolution_clock::time_point _last_exec_time;
+        // Guards the run bookkeeping below, as concurrent executors share the task. Held through a pointer,
+        // as tasks are moved around by the config.
+        std::unique_ptr<std::mutex> _run_mutex = std::make_unique<std::mutex>();
+
+        std::optional<webdash::TaskHandle> _in_flight;
+
+        // Per default, ::time_point is initialized to epoch. Loaded from the persistent run state on first use.
+        std::chrono::system_clock::time_point _last_exec_time;
+
+        bool _is_run_state_loaded = false;
 
         // Exactly that. Counts the number of times ::Run() was called.
         int _times_called = 0;
@@ -55,7 +149,22 @@ class WebDashConfigTask {
 
         bool _notify_dashboard = false;
 
+        // Each action is terminated once it runs longer than this.
+        std::optional<std::chrono::milliseconds> _timeout;
+
+        bool _fail_fast = false;
+
+        bool _use_cache = false;
+
+        // Glob patterns of files read and written by the actions, relative to the working directory.
+        vector<string> _inputs;
+        vector<string> _outputs;
+
         string _when_to_execute;
 
         string _config_path;
+
+        uint64_t _source_hash = 0;
+
+        vector<string> _referenced_definitions;
 };
\ No newline at end of file
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+class WebDashConfig;
+
+/**
+ *
+ * Watches loaded configs and $myworld/definitions.json with inotify, so that a long-running
+ * daemon picks up edits without reloading everything.
+ *
+ * Directories are watched rather than the files themselves, since editors tend to replace a
+ * file (write aside, rename) instead of writing to it. A directory that is removed is watched
+ * again once it exists anew, and its files count as changed then. Changes are only recorded by the
+ * watcher's thread; Apply() reloads the affected configs (see WebDashConfig::Reload) on the
+ * caller's thread, at a time nobody uses their tasks.
+ *
+ * */
+class WebDashConfigWatcher {
+    public:
+        // {on_change} is called from the watcher's thread once watched files changed.
+        WebDashConfigWatcher(std::function<void()> on_change = nullptr);
+
+        ~WebDashConfigWatcher();
+
+        WebDashConfigWatcher(const WebDashConfigWatcher&) = delete;
+
+        // Watches the file of {config} and the definitions. {config} must outlive the watcher.
+        // Returns false iff the file can't be watched.
+        bool Watch(WebDashConfig* config);
+
+        // True iff watched files changed since the last Apply().
+        bool HasChanges();
+
+        // Reloads the configs whose file changed, and all of them if the definitions changed.
+        // Returns false iff there was nothing to reload.
+        bool Apply();
+
+    private:
+        void _Loop();
+
+        // Adds an inotify watch for {directory}, unless there is one. Requires _mutex to be held.
+        bool _WatchDirectory(const string& directory);
+
+        // Watches those of _lost_directories that exist again. Returns true iff one does.
+        // Requires _mutex to be held.
+        bool _RestoreWatches();
+
+        int _inotify_fd = -1;
+
+        // Written to by the destructor to end _Loop().
+        int _stop_fd = -1;
+
+        std::function<void()> _on_change;
+
+        std::thread _thread;
+
+        std::mutex _mutex;
+
+        // Watch descriptor -> watched directory.
+        unordered_map<int, string> _directories;
+
+        // Directories whose watch went away along with them.
+        unordered_set<string> _lost_directories;
+
+        // Canonical path of a config file -> configs loaded from it.
+        unordered_map<string, vector<WebDashConfig*>> _configs;
+
+        string _definitions_path;
+
+        // Canonical paths of files changed since the last Apply().
+        unordered_set<string> _changed;
+};
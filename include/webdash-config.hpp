@@ -2,42 +2,137 @@
 
 #include "webdash-config-task.hpp"
 #include "webdash-core.hpp"
+#include "webdash-substitutions.hpp"
 
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
 #include <nlohmann/json.hpp>
 
 using namespace std;
 using json = nlohmann::json;
 
+class WebDashScheduler;
+
 class WebDashConfig {
     public:
-        WebDashConfig(string path);
+        // Builds all tasks loaded from the JSON right away, which reports configuration errors up front.
+        // With {is_lazy}, a task is only built (parsed, substituted, split) when first needed, e.g. by
+        // GetTask(), Run(name) or dependency resolution; meant for callers running a single task.
+        WebDashConfig(string path, bool is_lazy = false);
 
         // Runs a single task with name {cmdName} or all if none provided or "" is provided.
         std::vector<webdash::RunReturn> Run(const string cmdName = "", webdash::RunConfig runconfig = {});
 
+        // Returns a daemon running the timed tasks of this config whenever they are due.
+        // Must not outlive this config.
+        std::unique_ptr<WebDashScheduler> CreateScheduler(webdash::RunConfig runconfig = {});
+
         std::vector<std::pair<string,string>> GetAllDefinitions() const;
 
+        // GetAllDefinitions() as of the last (re)load, compiled: what the tasks are substituted with.
+        // Built once per load rather than per task.
+        const webdash::Substitutions& GetSubstitutions() const { return _substitutions; }
+
+        // Environment of the actions: the process environment plus the "env" definitions.
+        std::shared_ptr<const webdash::Environment> GetEnvironment() const { return _environment; }
+
+        // Brings the config up to date with its file and the definitions. Tasks are matched by name:
+        // those whose entry and referenced definitions are unchanged are kept as they are, runtime
+        // state included; only the others are rebuilt. If the file fails to parse, the tasks stay as
+        // they were. Invalidates pointers to tasks.
         void Reload();
 
+        // Writes a binary image of the loaded tasks (substitutions applied, actions split) to
+        // GetImagePath(). Later loads map it instead of parsing the JSON, as long as neither the
+        // config nor the definitions changed. Returns false iff writing failed.
+        bool Compile();
+
+        string GetImagePath() const { return _path + ".bin"; }
+
         string GetPath() const;
 
         void Serialize(WriterType writer);
 
         bool IsLoaded() const { return _is_loaded; };
         
-        vector<string> GetTaskList();
+        vector<string> GetTaskList() const;
+
+        // Returns the task named {cmdname}, or nullptr. Valid until the config is reloaded.
+        // May be called concurrently.
+        WebDashConfigTask* GetTask(const string& cmdname);
 
-        std::optional<WebDashConfigTask> GetTask(const string cmdname);
+        // All tasks, in the order of the config. Valid until the config is reloaded.
+        vector<WebDashConfigTask*> GetTasks();
     private:
 
         // Loads the config. Returns false iff failure detected.
         bool Load();
 
+        // Sets _definitions and compiles them into _substitutions.
+        void _SetDefinitions(vector<pair<string, string>> definitions);
+
+        // Reads the config file into _config. Returns false iff failure detected.
+        bool _Parse();
+
+        // Loads the tasks from the image written by Compile(). Returns false if there is none,
+        // or it is stale or corrupt.
+        bool _LoadImage();
+
+        // Builds task {index}, unless it was already. Returns it.
+        WebDashConfigTask* _Materialize(size_t index);
+
+        // Lists the commands of _config in tasks, none of them built yet.
+        void _IndexCommands();
+
+        // Rebuilds _task_index from tasks.
+        void _RebuildTaskIndex();
+
+        // Hash of everything the tasks depend on besides the config itself: definitions and environment.
+        uint64_t _GetDefinitionsHash() const;
+
+        // Resolves task references (":<task_name>" or "<config path>:<task_name>") for the executor.
+        // Other configs come from WebDashConfigRegistry and stay alive as long as the retriever.
+        std::function<WebDashConfigTask*(string)> _MakeTaskRetriever();
+
         json _config;
 
-        vector<WebDashConfigTask> tasks;
+        std::shared_ptr<const webdash::Environment> _environment;
+
+        // The definitions the tasks were substituted with.
+        vector<pair<string, string>> _definitions;
+
+        webdash::Substitutions _substitutions;
+
+        // A task of the config, built on load or, if lazy, on first use (see _Materialize).
+        struct TaskEntry {
+            // Index into _config["commands"].
+            size_t position = 0;
+
+            // The name as written and with substitutions applied.
+            string raw_name;
+            string name;
+
+            std::optional<WebDashConfigTask> task;
+        };
+
+        // Sized once per (re)load, so building a task never moves the others.
+        vector<TaskEntry> tasks;
+
+        // Task name -> index into tasks. For duplicate names, the first task wins.
+        unordered_map<string, size_t> _task_index;
+
+        // Serializes building tasks; dependency resolution may run on several threads.
+        std::mutex _materialize_mutex;
+
+        bool _is_lazy;
 
         string _path;
 
+        // Size and mtime (ns) of the config file when it was loaded.
+        uint64_t _source_size = 0;
+        int64_t _source_mtime = 0;
+
         bool _is_loaded;
 };
\ No newline at end of file
@@ -1,19 +1,28 @@
 #pragma once
 
 #include <webdash-log-code.hpp>
+#include <webdash-logger.hpp>
 
 #include <string>
 #include <optional>
 #include <vector>
 #include <functional>
+#include <atomic>
 #include <filesystem>
 #include <map>
+#include <memory>
+#include <mutex>
 
 using namespace std;
 
 // Must be specified by consuming libraries.
 extern const string _WEBDASH_PROJECT_NAME_;
 
+// Log types more verbose than this are compiled out of WEBDASH_LOG (see WebDash::GetLogVerbosity).
+#ifndef WEBDASH_LOG_MAX_VERBOSITY
+#define WEBDASH_LOG_MAX_VERBOSITY 3
+#endif
+
 namespace WebDash {
     enum class StoreWriteType {
         Append,
@@ -42,6 +51,32 @@ namespace WebDash {
         { WebDash::LogType::DEBUG,  "debug"}
     };
 
+    // 0 = ERR, NOTIFY (always logged), 1 = INFO, 2 = WARN, 3 = DEBUG.
+    constexpr int GetLogVerbosity(LogType type) {
+        switch (type) {
+            case LogType::INFO:  return 1;
+            case LogType::WARN:  return 2;
+            case LogType::DEBUG: return 3;
+            default:             return 0;
+        }
+    }
+
+    constexpr bool IsLogCompiled(LogType type) {
+        return GetLogVerbosity(type) <= WEBDASH_LOG_MAX_VERBOSITY;
+    }
+
+    // The parsed definitions.json of a root directory. Never changes once built; see WebDashCore::GetDefinitions.
+    struct Definitions {
+        // Format of each element: {.first = $#.A.B.C.D.E, .second = value)
+        vector<pair<string, string>> custom;
+
+        // The "env" definitions: {.first = variable name, .second = value}.
+        vector<pair<string, string>> env;
+
+        // False iff the file does not exist or is not JSON.
+        bool is_valid = false;
+    };
+
     struct PullProject {
         string source;
         string destination;
@@ -80,6 +115,10 @@ class WebDashCore {
         //         This is useful to probe the current root directory.
         vector<pair<string, string>> GetCustomDefinitions(bool file_must_exist = true);
 
+        // Returns the parsed GetMyWorldRootDirectory()/definitions.json. The file is parsed once and the
+        // result shared until the file changes (mtime, size or inode); each call costs a stat().
+        std::shared_ptr<const WebDash::Definitions> GetDefinitions();
+
         // Returns the webdash root directory.
         string GetMyWorldRootDirectory();
 
@@ -93,11 +132,25 @@ class WebDashCore {
         void LoadFromMyStorage(const string filename, WebDash::StoreReadType type, std::function<void(istream&)> fnc);
 
         // Logs into GetAndCreateLogDirectory()/app-temporary/logging/_WEBDASH_PROJECT_NAME_;
+        // The record is written in the background, see WebDashLogger. Dropped if {type} is not
+        // enabled; prefer WEBDASH_LOG, which does not even build the message then.
         void Log(WebDash::LogType type,
-                 const std::string msg,
+                 std::string msg,
                  const LogCode logcode = LogCode::E_UNKNOWN,
                  const bool append_if_possible = false);
 
+        // Returns once everything logged so far is written to the log files.
+        void FlushLog();
+
+        // Logs types up to the verbosity of {level}, e.g. INFO: ERR, NOTIFY and INFO. Initially
+        // $WEBDASH_LOG_LEVEL (error, info, warn or debug), or INFO.
+        void SetLogLevel(WebDash::LogType level);
+
+        bool IsLogEnabled(WebDash::LogType type) const {
+            return WebDash::IsLogCompiled(type) &&
+                   WebDash::GetLogVerbosity(type) <= _log_verbosity.load(std::memory_order_relaxed);
+        }
+
         void Notify(const std::string msg, const LogCode logcode = LogCode::N_UNKNOWN);
 
         // Return path of logging directory and create if not exists:
@@ -119,8 +172,19 @@ class WebDashCore {
 
         void _InitializeLoggingFiles();
 
-        // Is log type output initialized
-        std::map<WebDash::LogType, bool> _is_logtype_initialized;
+        WebDash::Definitions _ParseDefinitions(const string& path);
+
+        WebDashLogger _logger;
+
+        std::atomic<int> _log_verbosity { WebDash::GetLogVerbosity(WebDash::LogType::INFO) };
+
+        // Last result of GetDefinitions(), and what it was built from.
+        std::shared_ptr<const WebDash::Definitions> _definitions;
+        string _definitions_path;
+        uint64_t _definitions_inode = 0;
+        int64_t _definitions_size = -1;
+        int64_t _definitions_mtime = 0;
+        std::mutex _definitions_mutex;
 
         static std::optional<WebDashCore> _config;
 
@@ -140,6 +204,18 @@ inline WebDashCore& MyWorld() {
 // reduce the direct usage of the WebDashCore() object across the codebase.
 //
 
+// Logs like MyWorld().Log(type, ...), but the arguments are only evaluated if {type} is enabled,
+// and the call is compiled out if {type} is above WEBDASH_LOG_MAX_VERBOSITY:
+//     WEBDASH_LOG(WebDash::LogType::DEBUG, "Command: " + cmd.dump());
+#define WEBDASH_LOG(type, ...)                                  \
+    do {                                                        \
+        if constexpr (WebDash::IsLogCompiled(type)) {           \
+            WebDashCore& webdash_log_core_ = MyWorld();         \
+            if (webdash_log_core_.IsLogEnabled(type))           \
+                webdash_log_core_.Log(type, __VA_ARGS__);       \
+        }                                                       \
+    } while (false)
+
 namespace myworld {
     inline void notify(const std::string msg, const LogCode logcode = LogCode::N_UNKNOWN) {
         MyWorld().Log(WebDash::LogType::NOTIFY, msg, logcode, true);
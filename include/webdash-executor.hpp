@@ -0,0 +1,196 @@
+#pragma once
+
+#include "webdash-config-task.hpp"
+#include "webdash-task-handle.hpp"
+#include "webdash-types.hpp"
+
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+/**
+ *
+ * Executes webdash tasks as a DAG with at most RunConfig::jobs processes running at a time.
+ *
+ * Every task becomes a node. A node first starts all of its dependencies and, once they
+ * finished, executes its actions in the given order. Actions referring to other tasks are
+ * nodes themselves.
+ *
+ * Nothing blocks: a node waiting for other nodes or for its process is parked. Whoever
+ * finishes the awaited work, usually the supervisor thread reporting a process exit, only
+ * queues it; a small process-wide pool of driver threads resumes it. Hence no thread is
+ * needed per running task, and completion callbacks never execute tasks themselves.
+ *
+ * Outputs and return codes are aggregated in declaration order, i.e. the RunReturn of a
+ * task is the same as if everything were executed sequentially.
+ *
+ * Tasks declaring inputs/outputs skip their actions if these didn't change since the last
+ * successful run. This is checked once all dependencies finished, as they may produce inputs.
+ * Cacheable tasks may also get their result, including output files, from the action cache;
+ * skipped as up to date, they still replay the output of their cached result.
+ *
+ * Nodes are memoized by task id: a task referenced by several others executes at most
+ * once per executor and all dependents share its RunReturn. Across executors (e.g. those
+ * the scheduler starts for several due tasks), a task in flight is not started again;
+ * the node waits for that run and shares its result instead (see WebDashConfigTask::Claim).
+ *
+ * Must be owned by a std::shared_ptr, in-flight work keeps the executor alive.
+ *
+ * */
+class WebDashExecutor : public std::enable_shared_from_this<WebDashExecutor> {
+    public:
+        WebDashExecutor(webdash::RunConfig config);
+
+        // Starts the given tasks and returns one handle per task, in the same order.
+        // Returns once all startable work is in flight.
+        vector<webdash::TaskHandle> Start(vector<WebDashConfigTask*> tasks);
+
+        // Starts the given tasks and waits for them.
+        vector<webdash::RunReturn> Run(vector<WebDashConfigTask*> tasks);
+
+        // Stops scheduling new work and cancels running processes. Triggered automatically
+        // once a step of a fail-fast task (or RunConfig::fail_fast) failed.
+        void Cancel();
+
+    private:
+        struct Node;
+
+        // Either a command to execute or another task to wait for.
+        struct Step {
+            string action;
+
+            // The prepared command lines of an action step.
+            const webdash::Pipeline* pipeline = nullptr;
+
+            Node* child = nullptr;
+            bool is_cyclic = false;
+        };
+
+        struct Node {
+            WebDashConfigTask* task = nullptr;
+
+            // Set for the tasks given to Start().
+            std::optional<webdash::TaskHandle> root_handle;
+
+            // Completed along with the node; what other executors wait for if they need the task meanwhile.
+            webdash::TaskHandle run;
+
+            // Set if the task was in flight in another executor, whose result is taken over.
+            bool is_joined = false;
+
+            // Dependencies first, then actions.
+            vector<Step> steps;
+
+            size_t next_step = 0;
+
+            // Index of the first action step, i.e. the number of dependency steps.
+            size_t first_action = 0;
+
+            // Set once the actions were skipped because inputs and outputs are unchanged.
+            bool is_up_to_date = false;
+
+            bool is_skip_checked = false;
+
+            // Set while the actions execute if their result goes into the action cache.
+            std::optional<uint64_t> cache_key;
+
+            bool is_started = false;
+
+            bool is_queued = false;
+
+            bool is_done = false;
+
+            // Number of unfinished nodes this node is waiting for.
+            int pending = 0;
+
+            vector<Node*> waiters;
+
+            // The process of the current step, if one is running.
+            std::optional<webdash::TaskHandle> running;
+
+            webdash::RunReturn result;
+
+            // Once the actions start, {result} only collects theirs, which is what goes into the
+            // action cache; the dependencies' results are kept here until the node is done.
+            webdash::RunReturn dependency_result;
+        };
+
+        // Processes ready nodes on the calling thread until none is left.
+        void _Drive();
+
+        // Makes a driver thread call _Drive(), unless one is about to already.
+        void _Schedule();
+
+        void _Process(Node* node);
+
+        // Resolves dependencies and actions of a freshly started node. Returns false iff the node has to wait.
+        bool _Start(Node* node);
+
+        // Makes {node} wait for {in_flight}, a run of its task by another executor.
+        void _Join(Node* node, const webdash::TaskHandle& in_flight);
+
+        // Decides whether the actions of {node} can be skipped: they are up to date, or the result is restored
+        // from the action cache. Otherwise prepares caching the result.
+        bool _SkipActions(Node* node);
+
+        // Uses {cached} as the result of the actions of {node}, replaying its output.
+        void _UseCached(Node* node, webdash::RunReturn cached);
+
+        // Writes a captured (cached) result to the output sink, or to the terminal if there is none.
+        void _Replay(const string& taskid, const webdash::RunReturn& result);
+
+        // Launches the command of the node's current step, or parks the node if all job slots are taken.
+        void _Launch(Node* node, const webdash::Pipeline& pipeline);
+
+        // Returns the node of {task}, creating it if this is the first reference. Requires _mutex to be held.
+        Node* _GetOrCreateChild(Node* parent, WebDashConfigTask* task, bool& is_cyclic);
+
+        // True iff {target} is reachable from {from} through subtasks. Requires _mutex to be held.
+        bool _Reaches(Node* from, Node* target) const;
+
+        // Requires _mutex to be held.
+        void _Enqueue(Node* node);
+
+        void _Finish(Node* node);
+
+        // Marks the run cancelled and collects the processes to stop. Returns false iff it was cancelled already.
+        // Requires _mutex to be held.
+        bool _Abort(vector<webdash::TaskHandle>& running);
+
+        // Cancels the processes collected by _Abort(), outside of the lock.
+        void _Stop(const vector<webdash::TaskHandle>& running);
+
+        // True iff a failure of {node} or its dependencies cancels the whole run.
+        bool _IsFailFast(Node* node) const;
+
+        webdash::RunConfig _config;
+
+        int _jobs = 1;
+
+        // Number of processes currently running.
+        int _running = 0;
+
+        // Nodes waiting for a free job slot.
+        deque<Node*> _launch_queue;
+
+        bool _is_cancelled = false;
+
+        // Nodes are never moved once created; std::list keeps the pointers stable.
+        list<Node> _nodes;
+
+        // Run-scoped execution cache, keyed by task id (path#name).
+        unordered_map<string, Node*> _nodes_by_taskid;
+
+        deque<Node*> _ready;
+
+        // Set while a _Drive() posted by _Schedule() has not yet seen _ready empty.
+        bool _is_drive_scheduled = false;
+
+        std::mutex _mutex;
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+using namespace std;
+using json = nlohmann::json;
+
+namespace webdash {
+    constexpr uint64_t kFnv1aOffsetBasis = 14695981039346656037ull;
+
+    // 64-bit FNV-1a. Pass the result of a previous call as {seed} to hash data piecewise.
+    uint64_t Fnv1a(const void* data, size_t len, uint64_t seed);
+
+    inline uint64_t Fnv1a(const string& data, uint64_t seed = kFnv1aOffsetBasis) {
+        return Fnv1a(data.data(), data.size(), seed);
+    }
+
+    // Content hash of the file at {path}, or nullopt if it can't be read.
+    std::optional<uint64_t> HashFile(const string& path);
+
+    string ToHex(uint64_t value);
+
+    // Expands glob(3) patterns. Relative patterns are relative to {base}. Matched directories
+    // stand for all regular files below them. The result is sorted and free of duplicates.
+    vector<string> ExpandGlobs(const vector<string>& patterns, const string& base);
+}
+
+/**
+ *
+ * Remembers the state of declared inputs and outputs of successfully executed tasks, so that
+ * up-to-date tasks can be skipped. The manifest is kept in GetPersistenteStoragePath().
+ * Concurrent invocations share it: a change is merged into the manifest on disk under a lock
+ * and written aside, then renamed into place, so a crash never leaves a partial manifest.
+ *
+ * Files are compared by mtime and size first. Only if these differ, the content hash decides,
+ * so touching a file without changing it doesn't cause a re-run.
+ *
+ * */
+class WebDashFingerprintStore {
+    public:
+        static WebDashFingerprintStore& Get();
+
+        WebDashFingerprintStore(const WebDashFingerprintStore&) = delete;
+
+        // True iff the task last succeeded with the same {definition}, and its {inputs} and
+        // {outputs} (expanded file lists) are the same files with unchanged contents.
+        bool IsUpToDate(const string& taskid, uint64_t definition, const vector<string>& inputs, const vector<string>& outputs);
+
+        // Stores the current state of {inputs} and {outputs} after a successful run.
+        void Record(const string& taskid, uint64_t definition, const vector<string>& inputs, const vector<string>& outputs);
+
+        // Forgets the task, e.g. after a failed run, so that it executes next time.
+        void Invalidate(const string& taskid);
+
+    private:
+        WebDashFingerprintStore() = default;
+
+        // The methods below require _mutex to be held.
+
+        void _Load();
+
+        // Writes the entry of {taskid} (or its absence) to disk, and adopts what other processes
+        // wrote meanwhile.
+        void _Save(const string& taskid);
+
+        // True iff {path} still matches the stored {fingerprint}. Refreshes the stored mtime if only
+        // the mtime changed, and sets {is_refreshed} in that case.
+        bool _Matches(json& fingerprint, const string& path, bool& is_refreshed);
+
+        // Fingerprints the given files, reusing hashes of {previous} for files whose mtime and size didn't change.
+        json _Fingerprint(const vector<string>& paths, const json* previous);
+
+        bool _is_loaded = false;
+
+        // { taskid: { "definition": hex, "inputs": { path: fingerprint }, "outputs": { path: fingerprint } } }
+        json _manifest = json::object();
+
+        std::mutex _mutex;
+};
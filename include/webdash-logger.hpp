@@ -0,0 +1,98 @@
+#pragma once
+
+#include <webdash-log-code.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace std;
+
+namespace WebDash {
+    enum class LogType;
+}
+
+/**
+ *
+ * Writes log records to <directory>/logging.<type>.txt in the background.
+ *
+ * Log() only timestamps a record and pushes it onto a lock-free list. A thread takes all
+ * pending records at once, every kFlushIntervalMs or on Flush(), formats them and writes them
+ * through files that stay open. Records are written in the order they were pushed; whatever is
+ * pending when the logger is destroyed (normally at exit) is written first.
+ *
+ * */
+class WebDashLogger {
+    public:
+        WebDashLogger() = default;
+
+        WebDashLogger(const WebDashLogger&) = delete;
+
+        ~WebDashLogger();
+
+        // Starts writing to {directory}, creating it if needed. Records logged before are kept until then,
+        // up to a bound; further ones are dropped.
+        void Open(const string& directory);
+
+        // Never blocks. See WebDashCore::Log for the arguments.
+        void Log(WebDash::LogType type, string msg, LogCode logcode, bool append_if_possible);
+
+        // Returns once everything logged before the call is written to the files.
+        void Flush();
+
+    private:
+        struct Record {
+            WebDash::LogType type;
+            LogCode logcode;
+            bool append_if_possible;
+            std::chrono::system_clock::time_point time;
+            string msg;
+
+            // The record pushed before this one.
+            Record* next = nullptr;
+        };
+
+        void _Loop();
+
+        // Removes all pending records, oldest first.
+        Record* _TakeAll();
+
+        // Writes and deletes {records}, then flushes the files.
+        void _Write(Record* records);
+
+        // "%F %T" of {time}; the last result is reused within the same second.
+        const string& _FormatTime(std::chrono::system_clock::time_point time);
+
+        // Most recently pushed record.
+        std::atomic<Record*> _head { nullptr };
+
+        std::atomic<bool> _is_open { false };
+
+        // Records logged while not open.
+        std::atomic<uint64_t> _held_records { 0 };
+
+        string _directory;
+
+        std::thread _thread;
+
+        // Guard the fields below; _wakeup wakes the thread, _flushed the callers of Flush().
+        std::mutex _mutex;
+        std::condition_variable _wakeup;
+        std::condition_variable _flushed;
+        uint64_t _flush_requested = 0;
+        uint64_t _flush_done = 0;
+        bool _is_stopping = false;
+
+        // Used by the writing thread only.
+        std::map<WebDash::LogType, FILE*> _files;
+        std::map<WebDash::LogType, bool> _is_logtype_initialized;
+        std::time_t _formatted_second = -1;
+        string _formatted_time;
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+using namespace std;
+
+namespace webdash {
+    /**
+     *
+     * A command line split into arguments once, stored as one immutable block: all arguments
+     * back to back in a single buffer, plus the NULL-terminated pointer array execve expects.
+     * Copies share the block, so handing a command to the spawn call costs a pointer.
+     *
+     * Splitting follows the POSIX shell, without any expansions:
+     *   - unquoted whitespace separates arguments,
+     *   - '...' is taken literally,
+     *   - "..." is taken literally except for \" \\ \$ \` (escaped) and \<newline> (removed),
+     *   - \c outside of quotes stands for c,
+     *   - adjacent parts form one argument: a"b c"'d' is "ab cd".
+     *
+     * */
+    class Command {
+        public:
+            Command() = default;
+
+            // Returns nullopt on an unterminated quote or a trailing backslash, with the reason in {error}.
+            static std::optional<Command> Parse(const string& line, string* error = nullptr);
+
+            // Takes arguments that are split already, e.g. received from another machine.
+            static Command FromArgv(const vector<string>& args, const string& text);
+
+            // NULL-terminated, valid as long as this command (or a copy) exists.
+            char* const* GetArgv() const;
+
+            size_t GetArgc() const;
+
+            // The command line as written.
+            const string& GetText() const { return _text; }
+
+        private:
+            struct Block {
+                Block() = default;
+                Block(const Block&) = delete;
+
+                string storage;
+
+                // Points into storage.
+                vector<char*> argv;
+            };
+
+            string _text;
+
+            std::shared_ptr<const Block> _block;
+    };
+
+    /**
+     *
+     * Environment of spawned children: the parent's environment with {additions} set on top,
+     * compiled into one immutable block like Command.
+     *
+     * */
+    class Environment {
+        public:
+            static std::shared_ptr<const Environment> Build(const vector<pair<string, string>>& additions);
+
+            Environment(const Environment&) = delete;
+
+            // NULL-terminated.
+            char* const* GetEnvp() const { return _envp.data(); }
+
+            // What was set on top of the parent's environment, e.g. to rebuild it on another machine.
+            const vector<pair<string, string>>& GetAdditions() const { return _additions; }
+
+        private:
+            Environment() = default;
+
+            vector<pair<string, string>> _additions;
+
+            string _storage;
+
+            vector<char*> _envp;
+    };
+
+    // An action: one command, or several of them with the stdout of each feeding the stdin of the next.
+    struct Pipeline {
+        vector<Command> stages;
+
+        // The action as written. Stages are joined with " | ".
+        string text;
+    };
+
+    // Everything a child process needs. Prepared by the parent before spawning.
+    struct LaunchSpec {
+        Command command;
+
+        // The parent's environment if not set.
+        std::shared_ptr<const Environment> environment;
+
+        std::optional<string> wdir;
+
+        // Descriptors installed as the child's stdin/stdout/stderr. -1 keeps the parent's.
+        int stdin_fd = -1;
+        int stdout_fd = -1;
+        int stderr_fd = -1;
+
+        // Process group to put the child in, so that it can be signalled together with everything
+        // it spawns: 0 creates a new one (pgid = pid), other values join an existing group.
+        // The parent's group if not set.
+        std::optional<pid_t> process_group;
+    };
+
+    // Starts argv[0] (searched in PATH) without copying the parent's address space.
+    // Uses posix_spawn, or vfork on C libraries lacking posix_spawn_file_actions_addchdir_np.
+    // The child executes no user-space code between spawn and exec, so this is safe to call
+    // from multiple threads and its cost does not depend on the parent's heap size.
+    //
+    // Returns the pid of the child, or -1 on failure (errno is set).
+    pid_t Spawn(const LaunchSpec& spec);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+using namespace std;
+
+namespace webdash {
+    // What is remembered about a task across processes. Times are milliseconds since epoch.
+    struct RunState {
+        int64_t last_start = 0;
+        int64_t last_end = 0;
+        int last_result = 0;
+        uint64_t run_count = 0;
+    };
+}
+
+/**
+ *
+ * Persistent scheduling state of all tasks, keyed by task id, so that frequency gating
+ * works across invocations.
+ *
+ * Updates are appended to a log as single lines (one write() each, O_APPEND), which is
+ * cheap and never rewrites existing data. Start records carry an increment of the run count,
+ * so that concurrent processes don't lose each other's runs. Once the log grew long, the
+ * state is written to a snapshot (written aside, fsync'ed and renamed into place) and the
+ * log is truncated. A torn last line left by a crash is ignored.
+ *
+ * Several processes may share the store: appends hold a shared flock on the log,
+ * compaction an exclusive one. Each process remembers how far it read the log and takes in
+ * the records appended since on every lookup; after a compaction it reads everything anew.
+ *
+ * */
+class WebDashRunStateStore {
+    public:
+        static WebDashRunStateStore& Get();
+
+        WebDashRunStateStore(const WebDashRunStateStore&) = delete;
+
+        ~WebDashRunStateStore();
+
+        // Returns the stored state of {taskid}, loading the store on first use.
+        std::optional<webdash::RunState> Find(const string& taskid);
+
+        void RecordStart(const string& taskid, std::chrono::system_clock::time_point when);
+
+        void RecordEnd(const string& taskid, std::chrono::system_clock::time_point when, int result);
+
+    private:
+        WebDashRunStateStore() = default;
+
+        // The methods below require _mutex to be held.
+
+        void _Load();
+
+        // Reads snapshot and log into _states. A torn last record is cut off iff {may_truncate},
+        // which requires the exclusive lock.
+        void _ReadFromDisk(bool may_truncate);
+
+        // Takes in the records appended to the log since it was last read. Requires a lock on the log.
+        void _Refresh();
+
+        // Applies the log records in {lines} to _states. Returns their number.
+        size_t _Replay(const string& lines);
+
+        // Identifies the current snapshot file, which compaction replaces.
+        std::pair<int64_t, int64_t> _GetSnapshotVersion() const;
+
+        void _Append(const string& line);
+
+        void _Compact();
+
+        bool _is_loaded = false;
+
+        string _snapshot_path;
+
+        string _log_path;
+
+        int _log_fd = -1;
+
+        // Records in the log, as far as we know.
+        size_t _log_records = 0;
+
+        // Bytes of the log read into _states.
+        size_t _log_offset = 0;
+
+        // The snapshot _states is based on.
+        std::pair<int64_t, int64_t> _snapshot_version { 0, 0 };
+
+        unordered_map<string, webdash::RunState> _states;
+
+        std::mutex _mutex;
+};
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+using namespace std;
+
+namespace webdash {
+    /**
+     *
+     * Standard five-field cron expression (minute hour day-of-month month day-of-week),
+     * evaluated in local time. Fields accept "*", numbers, ranges "a-b", steps "x/n"
+     * and comma-separated lists. Day-of-week 0 and 7 are both Sunday. If both day fields
+     * are restricted, a day matching either of them matches (as in Vixie cron).
+     *
+     * */
+    class CronExpression {
+        public:
+            // Returns nullopt if {expression} is malformed.
+            static std::optional<CronExpression> Parse(const string& expression);
+
+            // The first matching minute strictly after {after}, or time_point::max() if there is none.
+            std::chrono::system_clock::time_point NextMatch(std::chrono::system_clock::time_point after) const;
+
+        private:
+            uint64_t _minutes = 0;
+            uint32_t _hours = 0;
+            uint32_t _days_of_month = 0;
+            uint32_t _months = 0;
+            uint32_t _days_of_week = 0;
+
+            bool _is_dom_restricted = false;
+            bool _is_dow_restricted = false;
+    };
+
+    /**
+     *
+     * The "frequency" and "when" fields of a task, parsed once at load:
+     *   - a number: interval in milliseconds,
+     *   - "daily": interval of 24 hours,
+     *   - five whitespace-separated fields: a cron expression,
+     *   - "when": "new-day" additionally requires a new (UTC) calendar day since the last run.
+     *
+     * */
+    class Schedule {
+        public:
+            using TimePoint = std::chrono::system_clock::time_point;
+
+            enum class Kind {
+                // No frequency given; due whenever asked.
+                None,
+                Interval,
+                Cron
+            };
+
+            static Schedule Compile(const std::optional<string>& frequency, const string& when);
+
+            // False if the frequency was malformed. Such tasks are never due.
+            bool IsValid() const { return _is_valid; }
+
+            // True iff a frequency was given.
+            bool IsTimed() const { return _kind != Kind::None; }
+
+            // When the task is due next, given that it last started at {last_start}.
+            // A task that never ran (epoch) is due right away.
+            TimePoint NextDue(TimePoint last_start) const;
+
+        private:
+            Kind _kind = Kind::None;
+
+            bool _is_valid = true;
+
+            std::chrono::milliseconds _interval { 0 };
+
+            std::optional<CronExpression> _cron;
+
+            bool _on_new_day = false;
+    };
+}
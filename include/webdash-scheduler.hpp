@@ -0,0 +1,92 @@
+#pragma once
+
+#include "webdash-config-task.hpp"
+#include "webdash-config-watcher.hpp"
+#include "webdash-timer-wheel.hpp"
+#include "webdash-types.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+class WebDashConfig;
+
+/**
+ *
+ * Daemon executing timed tasks (see webdash::Schedule) whenever they are due. This replaces
+ * polling WebDashConfig::Run with run_only_with_frequency.
+ *
+ * Each task sits in a timer wheel at its next due time (millisecond ticks). The daemon sleeps
+ * until the earliest one, so thousands of scheduled tasks cost nothing between firings.
+ * A task is rescheduled once its run finished, hence runs of one task never overlap.
+ *
+ * With Watch(), edits of the config and the definitions are picked up while running: no new
+ * runs are started until those in flight finished, then the config is reloaded and its timed
+ * tasks scheduled anew.
+ *
+ * */
+class WebDashScheduler {
+    public:
+        // Schedules the timed ones among {tasks}. The tasks, and everything {config} refers to, must
+        // outlive the scheduler.
+        WebDashScheduler(vector<WebDashConfigTask*> tasks, webdash::RunConfig config);
+
+        WebDashScheduler(const WebDashScheduler&) = delete;
+
+        // Executes due tasks until Stop() is called. Returns once the runs in flight finished.
+        void Run();
+
+        // Makes Run() return. May be called from any thread.
+        void Stop();
+
+        // Keeps the scheduled tasks in sync with {config}, which they are to be taken from.
+        // {config} must outlive the scheduler. Call before Run().
+        bool Watch(WebDashConfig* config);
+
+    private:
+        using TimePoint = std::chrono::system_clock::time_point;
+
+        uint64_t _ToTick(TimePoint when) const;
+
+        TimePoint _FromTick(uint64_t tick) const;
+
+        // Puts task {index} into the wheel at its next due time. Requires _mutex to be held.
+        void _Reschedule(size_t index);
+
+        // Applies the changes the watcher saw and schedules the tasks of _watched anew. Requires
+        // _mutex to be held and no runs in flight.
+        void _Reload();
+
+        // Keeps the timed ones among {tasks}.
+        void _SetTasks(const vector<WebDashConfigTask*>& tasks);
+
+        vector<WebDashConfigTask*> _tasks;
+
+        webdash::RunConfig _config;
+
+        TimePoint _origin;
+
+        webdash::TimerWheel _wheel;
+
+        // Tasks whose run finished and that have to go back into the wheel.
+        vector<size_t> _finished;
+
+        int _running = 0;
+
+        bool _is_stopped = false;
+
+        bool _is_reload_pending = false;
+
+        std::mutex _mutex;
+
+        std::condition_variable _wakeup;
+
+        WebDashConfig* _watched = nullptr;
+
+        // Declared last: its thread calls back into the scheduler, so it has to go first.
+        std::unique_ptr<WebDashConfigWatcher> _watcher;
+};
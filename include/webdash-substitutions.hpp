@@ -0,0 +1,86 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace webdash {
+    /**
+     *
+     * A compiled table of definitions ("$#.a.b", "$.thisDir()", "$.rootDir()", ...) that expands
+     * texts in a single pass.
+     *
+     * The keys form a trie; a text is scanned once, and at every position the longest key
+     * starting there, if any, is replaced by its value. Values referring to other keys are
+     * resolved once, when the table is built (a key referring to itself, directly or not,
+     * is left as is). For duplicate keys, the first definition wins.
+     *
+     * */
+    class Substitutions {
+        public:
+            // A text split into literal and placeholder segments, see Parse().
+            struct Template {
+                struct Segment {
+                    string literal;
+
+                    // Index of the key, or -1 for a literal.
+                    int32_t key = -1;
+                };
+
+                vector<Segment> segments;
+            };
+
+            Substitutions();
+
+            explicit Substitutions(const vector<pair<string, string>>& definitions);
+
+            Template Parse(const string& text) const;
+
+            string Expand(const Template& tmpl) const;
+
+            // Expand(Parse(text)), without building the template.
+            string Apply(const string& text) const;
+
+            // Sets {referenced}[k] for every key k {tmpl} refers to, directly or through values of
+            // other keys. {referenced} has GetSize() elements.
+            void CollectReferences(const Template& tmpl, vector<bool>& referenced) const;
+
+            size_t GetSize() const { return _keys.size(); }
+
+            const string& GetKey(size_t index) const { return _keys[index]; }
+
+        private:
+            struct Node {
+                // Sorted by character.
+                vector<pair<unsigned char, int32_t>> children;
+
+                // Index of the key ending here, or -1.
+                int32_t key = -1;
+            };
+
+            // The longest key starting at {text}[{pos}]: its index and length, or -1.
+            pair<int32_t, size_t> _Match(const string& text, size_t pos) const;
+
+            // Resolves the value of key {index} (see class comment). {state}: 0 = to do,
+            // 1 = being resolved, 2 = done.
+            void _Resolve(size_t index, vector<char>& state);
+
+            vector<string> _keys;
+
+            // Values as defined, and with references to other keys replaced.
+            vector<string> _raw_values;
+            vector<string> _values;
+
+            // Keys the value of each key refers to, directly or not.
+            vector<vector<int32_t>> _dependencies;
+
+            vector<Node> _nodes;
+
+            // First character -> trie node below the root, or -1. Most characters start no key,
+            // which costs a single lookup.
+            std::array<int32_t, 256> _first;
+    };
+}
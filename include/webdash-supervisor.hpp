@@ -0,0 +1,137 @@
+#pragma once
+
+#include "webdash-capture.hpp"
+#include "webdash-process.hpp"
+#include "webdash-types.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+/**
+ *
+ * One event loop (epoll) on a background thread that supervises all running children:
+ * it drains their stdout/stderr pipes and learns about their exit through a pidfd.
+ * Nobody blocks per child, so a single thread serves thousands of in-flight processes.
+ *
+ * Children run in process groups of their own. Terminating a child sends SIGTERM to its
+ * group and, if it is still around after a grace period, SIGKILL.
+ *
+ * A child may be a pipeline: its stages are connected by plain pipes, so the data flows
+ * from process to process inside the kernel and never passes through this one. All stages
+ * share one process group and are supervised as a unit.
+ *
+ * */
+class WebDashSupervisor {
+    public:
+        // Returns the process-wide supervisor. Its thread is started on first use.
+        static WebDashSupervisor& Get();
+
+        WebDashSupervisor(const WebDashSupervisor&) = delete;
+
+        ~WebDashSupervisor();
+
+        // Spawns {stages}, the stdout of each feeding the stdin of the next, and supervises them.
+        // If {collect_output} is set, the output is collected into the RunReturn, if {sink} is set,
+        // it is streamed there: stdout of the last stage and stderr of all. Once every stage exited
+        // and the pipes are drained, {on_exit} is invoked with the result, usually on the supervisor
+        // thread. The result holds the exit code of each stage; the overall one is the last non-zero
+        // of them (like the shell's pipefail). Stages killed by SIGPIPE, because a later one stopped
+        // reading, count as successful. The child is terminated once it runs longer than {timeout}.
+        //
+        // Returns an id of the supervised child, or 0 if spawning failed (in which case {on_exit} is never called).
+        uint64_t Launch(vector<webdash::LaunchSpec> stages,
+                        bool collect_output,
+                        std::shared_ptr<webdash::OutputSink> sink,
+                        const string& taskid,
+                        std::optional<std::chrono::milliseconds> timeout,
+                        std::function<void(webdash::RunReturn)> on_exit);
+
+        // Terminates the process group of child {id}: SIGTERM now, SIGKILL after the grace period.
+        // Does nothing if the child is gone already.
+        void Terminate(uint64_t id);
+
+    private:
+        WebDashSupervisor();
+
+        struct Watch;
+
+        // Registration of one descriptor within epoll: an output pipe or the pidfd of a stage.
+        struct Slot {
+            Watch* watch;
+            int fd;
+            std::optional<webdash::PipeCapture> capture;
+            size_t stage = 0;
+        };
+
+        struct Watch {
+            uint64_t id;
+
+            // One per stage. The first one leads the process group.
+            vector<pid_t> pids;
+
+            string taskid;
+
+            bool is_terminating = false;
+
+            webdash::RunReturn result;
+
+            std::shared_ptr<webdash::OutputSink> sink;
+
+            vector<std::unique_ptr<Slot>> slots;
+
+            // Open slots, plus one reference held by Launch() while registering.
+            std::atomic<int> references { 0 };
+
+            std::function<void(webdash::RunReturn)> on_exit;
+        };
+
+        void _Loop();
+
+        void _Close(Slot* slot);
+
+        // Reaps stage {stage} of {watch}. Blocks iff {block} is set.
+        void _Reap(Watch* watch, size_t stage, bool block);
+
+        void _Release(Watch* watch);
+
+        enum class DeadlineAction {
+            Terminate,
+            Kill
+        };
+
+        // Requires _watches_mutex to be held.
+        void _AddDeadline(std::chrono::steady_clock::time_point when, uint64_t id, DeadlineAction action);
+
+        // Requires _watches_mutex to be held.
+        void _ArmTimer();
+
+        void _OnTimer();
+
+        int _epoll_fd = -1;
+
+        // Wakes the loop up for shutdown.
+        int _wakeup_fd = -1;
+
+        // Fires at the earliest deadline.
+        int _timer_fd = -1;
+
+        // Live children by id. Ids are never reused, unlike pids.
+        unordered_map<uint64_t, Watch*> _watches;
+
+        uint64_t _next_id = 1;
+
+        multimap<std::chrono::steady_clock::time_point, pair<uint64_t, DeadlineAction>> _deadlines;
+
+        std::mutex _watches_mutex;
+
+        std::thread _thread;
+};
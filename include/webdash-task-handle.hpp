@@ -0,0 +1,63 @@
+#pragma once
+
+#include "webdash-types.hpp"
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+namespace webdash {
+    /**
+     *
+     * Handle of an asynchronously running action or task. Copies share the same state.
+     *
+     * */
+    class TaskHandle {
+        public:
+            TaskHandle();
+
+            // Returns a handle that is finished already.
+            static TaskHandle Completed(RunReturn ret);
+
+            // Returns true iff the run has finished.
+            bool Poll() const;
+
+            // Blocks until the run has finished and returns its result.
+            RunReturn Wait() const;
+
+            // Requests cancellation. The handle still finishes, usually with a non-zero return code.
+            void Cancel() const;
+
+            bool IsCancelled() const;
+
+            // Invokes {callback} once the run has finished, right away if it already has.
+            // Runs on the thread that completes the handle.
+            void OnDone(std::function<void(const RunReturn&)> callback) const;
+
+            //
+            // Producer side.
+            //
+
+            void Complete(RunReturn ret) const;
+
+            // Sets what Cancel() does. Invoked immediately if cancellation was requested before.
+            void SetCanceller(std::function<void()> canceller) const;
+
+        private:
+            struct State {
+                std::mutex mutex;
+                std::condition_variable cv;
+                bool is_done = false;
+                bool is_cancelled = false;
+                RunReturn result;
+                vector<std::function<void(const RunReturn&)>> callbacks;
+                std::function<void()> canceller;
+            };
+
+            std::shared_ptr<State> _state;
+    };
+}
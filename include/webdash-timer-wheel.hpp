@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+namespace webdash {
+    /**
+     *
+     * Hierarchical timer wheel (Varghese & Lauck) over integer ticks.
+     *
+     * Level k has 64 slots of 64^k ticks each. A timer sits in the level of the highest
+     * 6-bit digit in which its expiry differs from the current tick, in the slot of that
+     * digit. Whenever time enters a slot of a higher level, the slot is cascaded down.
+     * Scheduling and cancelling are O(1), and time can jump straight to the next expiry,
+     * so idle periods cost nothing regardless of their length.
+     *
+     * Not thread-safe.
+     *
+     * */
+    class TimerWheel {
+        public:
+            // Ticks beyond this horizon are clamped.
+            static constexpr int kLevels = 7;
+            static constexpr int kSlotBits = 6;
+            static constexpr uint64_t kHorizon = 1ull << (kLevels * kSlotBits);
+
+            TimerWheel(uint64_t now = 0) : _now(now) {}
+
+            // The index refers into the slots.
+            TimerWheel(const TimerWheel&) = delete;
+
+            uint64_t GetNow() const { return _now; }
+
+            // (Re-)schedules timer {id} to expire at {tick}. Ticks in the past expire on the next Advance().
+            void Schedule(uint64_t id, uint64_t tick);
+
+            // Removes timer {id}, if scheduled.
+            void Cancel(uint64_t id);
+
+            // Moves time forward to {tick}. Returns the expired timers, earliest first.
+            vector<uint64_t> Advance(uint64_t tick);
+
+            // The earliest expiry of all timers, or nullopt if there are none.
+            std::optional<uint64_t> NextExpiry() const;
+
+            bool IsEmpty() const { return _index.empty(); }
+
+        private:
+            static constexpr int kSlots = 1 << kSlotBits;
+
+            struct Timer {
+                uint64_t id;
+                uint64_t expiry;
+            };
+
+            struct Location {
+                int level;
+                int slot;
+                list<Timer>::iterator it;
+            };
+
+            // Moves {it} out of {from} into the place its expiry belongs to, relative to _now.
+            void _Place(list<Timer>& from, list<Timer>::iterator it);
+
+            // Sets _now to {tick}, cascading the slots time enters. No timer may expire before {tick}.
+            void _SetNow(uint64_t tick);
+
+            int _GetSlot(uint64_t tick, int level) const {
+                return (tick >> (level * kSlotBits)) & (kSlots - 1);
+            }
+
+            uint64_t _now;
+
+            list<Timer> _slots[kLevels][kSlots];
+
+            // Bit i of _occupied[k] is set iff _slots[k][i] is non-empty.
+            uint64_t _occupied[kLevels] = {};
+
+            unordered_map<uint64_t, Location> _index;
+    };
+}
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 using namespace std;
@@ -7,14 +12,84 @@ using namespace std;
 class WebDashConfigTask;
 
 namespace webdash {
+    class OutputSink;
+}
+
+namespace webdash {
+    enum class Stream {
+        Stdout = 1,
+        Stderr = 2
+    };
+
+    // A piece of RunReturn::output: which stream it came from and when it arrived.
+    struct OutputChunk {
+        Stream stream;
+        std::chrono::system_clock::time_point time;
+        size_t offset;
+        size_t length;
+    };
+
+    // Exit code of one process. A pipeline action has one per stage.
+    struct StageResult {
+        string command;
+        int return_code = 0;
+    };
+
     struct RunReturn {
-        int return_code;
+        int return_code = 0;
+
+        // Every process executed, in order.
+        vector<StageResult> stages;
+
+        // stdout and stderr, interleaved in arrival order.
         string output;
+
+        vector<OutputChunk> chunks;
+
+        // Returns the output of a single stream.
+        string GetStream(Stream stream) const {
+            string ret;
+            for (const OutputChunk& chunk : chunks)
+                if (chunk.stream == stream)
+                    ret.append(output, chunk.offset, chunk.length);
+            return ret;
+        }
+
+        // Aggregates the result of a subtask or action into this one.
+        void Append(const RunReturn& sub) {
+            for (OutputChunk chunk : sub.chunks) {
+                chunk.offset += output.size();
+                chunks.push_back(chunk);
+            }
+
+            output += sub.output;
+            return_code |= sub.return_code;
+            stages.insert(stages.end(), sub.stages.begin(), sub.stages.end());
+        }
     };
 
     struct RunConfig {
         bool run_only_with_frequency = false;
         bool redirect_output_to_str = false;
-        std::function<std::optional<WebDashConfigTask>(string)> TaskRetriever;
+
+        // If set, output is streamed to the sink as it arrives, tagged with the task id.
+        // Unless redirect_output_to_str is set too, RunReturn::output stays empty.
+        std::shared_ptr<webdash::OutputSink> output_sink;
+
+        // Maximum number of tasks executed concurrently (-j N). 0 means one per hardware thread.
+        int jobs = 1;
+
+        // Abort the whole run on the first failure, as if every task had "fail-fast" set.
+        bool fail_fast = false;
+
+        // Size bound of the action cache, in bytes.
+        uint64_t action_cache_size = 1ull << 30;
+
+        // Addresses ("host:port") of webdash-worker processes. If given, actions run there instead of
+        // locally, and jobs = 0 means the total capacity of the workers.
+        vector<string> workers;
+
+        // Resolves a task reference to the task, or nullptr. The task must outlive the run.
+        std::function<WebDashConfigTask*(string)> TaskRetriever;
     };
 }
@@ -2,8 +2,9 @@
 #include <vector>
 using namespace std;
 
-string SubstituteKeywords(string src, string keyword, string replace_with);
+string SubstituteKeywords(string src, const string& keyword, const string& replace_with);
 
-string ApplySubstitutions(string src, vector<pair<string, string>> substitutions);
+// Replaces the keys of {substitutions} in {src}, see webdash::Substitutions.
+string ApplySubstitutions(const string& src, const vector<pair<string, string>>& substitutions);
 
 string GetDirectoryOf(string full_fulename);
\ No newline at end of file
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "webdash-capture.hpp"
+#include "webdash-process.hpp"
+#include "webdash-types.hpp"
+#include "webdash-worker.hpp"
+
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+namespace webdash {
+    // An action resolved for execution on another machine.
+    struct RemoteAction {
+        vector<Command> stages;
+
+        std::optional<string> wdir;
+
+        // Set on top of the worker's environment.
+        vector<pair<string, string>> environment;
+
+        std::optional<std::chrono::milliseconds> timeout;
+    };
+}
+
+/**
+ *
+ * Executes actions on webdash-worker processes (see WebDashWorker) instead of locally.
+ *
+ * Each worker announces its capacity on connect. An action goes to the worker with the most
+ * free capacity; if every worker is busy, it waits for the next one to become free. Output is
+ * streamed back while the action runs. Actions on a worker whose connection breaks fail.
+ *
+ * */
+class WebDashWorkerPool {
+    public:
+        // Returns the process-wide pool.
+        static WebDashWorkerPool& Get();
+
+        WebDashWorkerPool(const WebDashWorkerPool&) = delete;
+
+        ~WebDashWorkerPool();
+
+        // Connects to those of {addresses} ("host:port") that aren't connected yet.
+        // Returns the total capacity of all connected workers.
+        int Connect(const vector<string>& addresses);
+
+        // Like WebDashSupervisor::Launch, on one of {workers} (see Connect). Without {collect_output}
+        // and {sink}, the output goes to our stdout/stderr.
+        //
+        // Returns an id of the action, or 0 if no worker is reachable (in which case {on_exit} is never called).
+        uint64_t Launch(const vector<string>& workers,
+                        const webdash::RemoteAction& action,
+                        bool collect_output,
+                        std::shared_ptr<webdash::OutputSink> sink,
+                        const string& taskid,
+                        std::function<void(webdash::RunReturn)> on_exit);
+
+        // Terminates action {id} on its worker. Does nothing if it is done already.
+        void Terminate(uint64_t id);
+
+    private:
+        WebDashWorkerPool() = default;
+
+        struct Worker {
+            string address;
+
+            int fd = -1;
+
+            int capacity = 0;
+
+            int running = 0;
+
+            bool is_connected = true;
+
+            std::mutex write_mutex;
+
+            std::thread reader;
+        };
+
+        struct Run {
+            uint64_t id;
+
+            json request;
+
+            // Set once dispatched.
+            Worker* worker = nullptr;
+
+            bool collect_output;
+
+            std::shared_ptr<webdash::OutputSink> sink;
+
+            string taskid;
+
+            webdash::RunReturn result;
+
+            std::function<void(webdash::RunReturn)> on_exit;
+        };
+
+        // Receives the messages of {worker} until its connection breaks.
+        void _Read(Worker* worker);
+
+        void _OnOutput(Run* run, webdash::Stream stream, const string& data);
+
+        // Assigns waiting runs to workers with free capacity. Returns the requests to send.
+        // Requires _mutex to be held.
+        vector<pair<Worker*, json>> _Dispatch();
+
+        void _Send(const vector<pair<Worker*, json>>& requests);
+
+        // All workers ever connected. Broken ones stay, so pointers to them remain valid.
+        vector<std::unique_ptr<Worker>> _workers;
+
+        // The connected worker of each address.
+        unordered_map<string, Worker*> _workers_by_address;
+
+        unordered_map<uint64_t, std::unique_ptr<Run>> _runs;
+
+        // Runs waiting for free capacity, in launch order.
+        deque<uint64_t> _pending;
+
+        uint64_t _next_id = 1;
+
+        std::mutex _mutex;
+};
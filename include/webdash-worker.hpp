@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+using json = nlohmann::json;
+using namespace std;
+
+/**
+ *
+ * Protocol between webdash and webdash-worker processes, over TCP.
+ *
+ * Every message is a frame: two 32-bit big-endian lengths, then a JSON header of the first
+ * length, then a binary payload of the second. Output travels in the payload, so it is
+ * passed on byte for byte.
+ *
+ *   client -> worker  { "type": "auth", "secret": ... }                   on connect
+ *   worker -> client  { "type": "hello", "version": 2, "capacity": N }     once the secret matched
+ *   client -> worker  { "type": "run", "id": ..., "taskid": ..., "stages": [ { "argv": [...], "text": ... } ],
+ *                       "wdir": ..., "env": [ [ name, value ] ], "timeout_ms": ... }
+ *   worker -> client  { "type": "output", "id": ..., "stream": 1 | 2 }    + the output as payload
+ *   worker -> client  { "type": "exit", "id": ..., "return_code": ..., "stages": [ [ text, return_code ] ] }
+ *   client -> worker  { "type": "cancel", "id": ... }
+ *
+ * Ids are chosen by the client and unique per connection. "wdir" and "timeout_ms" may be null.
+ *
+ * A worker runs whatever its clients ask for, so it only serves clients knowing its secret
+ * (see GetWorkerSecret) and closes other connections right after their first frame. The secret
+ * travels in plain text: across untrusted networks, tunnel the connection (e.g. ssh -L).
+ *
+ * */
+namespace webdash {
+    constexpr int kWorkerProtocolVersion = 2;
+
+    // Sanity bounds; a peer announcing more is broken.
+    constexpr uint32_t kMaxFrameHeaderSize = 16 << 20;
+    constexpr uint32_t kMaxFramePayloadSize = 256 << 20;
+
+    struct Frame {
+        json header;
+        string payload;
+    };
+
+    // Returns false iff the connection is broken.
+    bool WriteFrame(int fd, const json& header, const char* payload = nullptr, size_t len = 0);
+
+    // Blocks until a whole frame arrived. Returns nullopt on end of stream, errors, malformed frames
+    // and frames exceeding the given sizes.
+    std::optional<Frame> ReadFrame(int fd,
+                                   uint32_t max_header_size = kMaxFrameHeaderSize,
+                                   uint32_t max_payload_size = kMaxFramePayloadSize);
+
+    // Connects to {address} ("host:port"). Returns the socket, or -1 on failure.
+    int ConnectTcp(const string& address);
+
+    // The secret shared by workers and their clients: $WEBDASH_WORKER_SECRET, or else the contents of
+    // <myworld>/app-persistent/data/webdash-worker/worker.secret, which is created with a random secret if
+    // missing (copy it to the machines involved). Shared by all programs of a myworld. Empty if neither
+    // can be had.
+    string GetWorkerSecret();
+}
+
+/**
+ *
+ * Executes actions on behalf of webdash clients on other machines (see WebDashWorkerPool):
+ * the serving part of a webdash-worker process.
+ *
+ * Every connection is served by a thread of its own, plus one writing to it. Actions run under the
+ * local WebDashSupervisor, their output is queued for the writer as it arrives, so a slow client
+ * never stalls the supervisor (one more than 64 MiB behind is disconnected). At most {capacity}
+ * actions run at once, further ones wait. Actions of a client that disconnects are terminated.
+ *
+ * */
+class WebDashWorker {
+    public:
+        // {capacity} of 0 means one action per hardware thread.
+        WebDashWorker(int capacity = 0);
+
+        WebDashWorker(const WebDashWorker&) = delete;
+
+        int GetCapacity() const { return _capacity; }
+
+        // Serves clients on {host}:{port} until Stop() is called. Returns false iff listening failed,
+        // or there is no secret to authenticate clients with.
+        //
+        // An empty {host} listens on 127.0.0.1 only; pass e.g. "0.0.0.0" or "::" to serve
+        // other machines. Port 0 picks a free one, see GetPort().
+        bool Serve(const string& host, uint16_t port);
+
+        // The port listened on, once Serve() is listening.
+        uint16_t GetPort() const { return _port; }
+
+        // Makes Serve() return. Connected clients are served until they disconnect.
+        void Stop();
+
+    private:
+        struct Connection;
+
+        void _Serve(std::shared_ptr<Connection> connection);
+
+        // Reads the first frame of {connection}. Returns true iff it carries our secret.
+        bool _Authenticate(Connection& connection);
+
+        // Launches {request} of {connection}, or queues it if all capacity is taken.
+        void _Start(std::shared_ptr<Connection> connection, json request);
+
+        // Launches {request} right away.
+        void _Launch(std::shared_ptr<Connection> connection, const json& request);
+
+        void _OnExit();
+
+        int _capacity;
+
+        string _secret;
+
+        std::atomic<int> _listen_fd { -1 };
+
+        std::atomic<uint16_t> _port { 0 };
+
+        std::atomic<bool> _is_stopped { false };
+
+        int _running = 0;
+
+        deque<pair<std::shared_ptr<Connection>, json>> _pending;
+
+        std::mutex _mutex;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+/**
+ *
+ * Index of all tasks in the $MYWORLD tree: every webdash.config.json below
+ * GetMyWorldRootDirectory() and the names of its tasks.
+ *
+ * Entries are task references as the executor resolves them, "<config path relative to
+ * the root>:<task name>".
+ *
+ * The tree is walked by several threads. Directories named app-temporary, app-persistent
+ * or .git are skipped, as are those matching a pattern (fnmatch, one per line) of
+ * $MYWORLD/.webdashignore; a pattern containing '/' is matched against the path relative
+ * to the root, others against the directory name.
+ *
+ * The index is saved in the persistent storage. A refresh only lists directories whose
+ * mtime changed and only parses configs whose mtime or size changed (all of them once the
+ * definitions changed, as task names are substituted); everything else is a stat() per
+ * directory.
+ *
+ * */
+class WebDashWorkspaceIndex {
+    public:
+        static WebDashWorkspaceIndex& Get();
+
+        WebDashWorkspaceIndex(const WebDashWorkspaceIndex&) = delete;
+
+        // Brings the index up to date with the tree and saves it.
+        void Refresh();
+
+        // All task references, sorted. Refreshes first, once per process.
+        vector<string> GetTasks();
+
+        // Task references matching {query}, best first: exact task names, then names starting with
+        // {query}, then references containing it, then those containing its characters in order.
+        // Refreshes first, once per process.
+        vector<string> Find(const string& query);
+
+    private:
+        WebDashWorkspaceIndex() = default;
+
+        struct Directory {
+            int64_t mtime = 0;
+
+            // Names of the subdirectories not ignored.
+            vector<string> subdirectories;
+
+            bool has_config = false;
+            int64_t config_mtime = 0;
+            uint64_t config_size = 0;
+            vector<string> tasks;
+        };
+
+        // Reads the saved index, unless it belongs to another root or other ignore patterns.
+        // Requires _mutex to be held.
+        void _Load();
+
+        // Requires _mutex to be held.
+        void _Save() const;
+
+        // Path of a directory relative to the root ("" for the root) -> what it contains.
+        unordered_map<string, Directory> _directories;
+
+        string _root;
+
+        vector<string> _ignore_patterns;
+
+        // Hash of the definitions the task names were substituted with.
+        uint64_t _definitions_hash = 0;
+
+        bool _is_loaded = false;
+
+        bool _is_refreshed = false;
+
+        std::mutex _mutex;
+};
@@ -0,0 +1,365 @@
+#include "webdash-action-cache.hpp"
+#include "webdash-core.hpp"
+#include "webdash-fingerprint.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <nlohmann/json.hpp>
+using namespace std;
+using json = nlohmann::json;
+
+
+namespace {
+    const string kCacheDirectory = "action-cache";
+
+    const string kIndexFile = "index.json";
+
+    // Serializes read-merge-write cycles of the index by concurrent invocations.
+    const string kLockFile = "index.lock";
+
+    const string kStagingSuffix = ".tmp-";
+
+    int64_t NowMs() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    bool WriteAll(int fd, const string& data) {
+        size_t written = 0;
+        while (written < data.size()) {
+            const ssize_t count = write(fd, data.data() + written, data.size() - written);
+            if (count < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            written += count;
+        }
+        return true;
+    }
+
+    // Holds an exclusive flock on {path} while alive.
+    class IndexLock {
+        public:
+            IndexLock(const std::filesystem::path& path) {
+                _fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+                if (_fd < 0) {
+                    perror("WebDashActionCache::IndexLock!open");
+                    return;
+                }
+
+                while (flock(_fd, LOCK_EX) != 0 && errno == EINTR) {}
+            }
+
+            ~IndexLock() {
+                if (_fd < 0)
+                    return;
+
+                flock(_fd, LOCK_UN);
+                close(_fd);
+            }
+
+            IndexLock(const IndexLock&) = delete;
+
+            bool IsLocked() const { return _fd >= 0; }
+
+        private:
+            int _fd = -1;
+    };
+}
+
+/* static */ WebDashActionCache& WebDashActionCache::Get() {
+    static WebDashActionCache cache;
+    return cache;
+}
+
+std::optional<webdash::RunReturn> WebDashActionCache::Restore(uint64_t key, bool restore_files) {
+    const string name = webdash::ToHex(key);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    // Also keeps other processes from evicting the entry while it is read.
+    IndexLock index_lock(_GetRoot() / kLockFile);
+    if (!index_lock.IsLocked())
+        return nullopt;
+
+    _Load();
+
+    auto it = _entries.find(name);
+    if (it == _entries.end())
+        return nullopt;
+
+    const std::filesystem::path path = _GetEntryPath(name);
+
+    webdash::RunReturn ret;
+    json meta;
+    try {
+        ifstream meta_stream(path / "result.json");
+        meta_stream >> meta;
+
+        ifstream output_stream(path / "output", ios::binary);
+        ret.output.assign(std::istreambuf_iterator<char>(output_stream), std::istreambuf_iterator<char>());
+
+        ret.return_code = meta["return_code"].get<int>();
+        for (const json& chunk : meta["chunks"]) {
+            webdash::OutputChunk parsed;
+            parsed.stream = static_cast<webdash::Stream>(chunk[0].get<int>());
+            parsed.offset = chunk[1].get<size_t>();
+            parsed.length = chunk[2].get<size_t>();
+            parsed.time = std::chrono::system_clock::time_point(std::chrono::milliseconds(chunk[3].get<int64_t>()));
+
+            if (parsed.offset + parsed.length > ret.output.size())
+                throw std::out_of_range("chunk");
+
+            ret.chunks.push_back(parsed);
+        }
+
+        // Entries of older versions lack the stages.
+        for (const json& stage : meta.value("stages", json::array()))
+            ret.stages.push_back(webdash::StageResult { stage[0].get<std::string>(), stage[1].get<int>() });
+    } catch (...) {
+        WEBDASH_LOG(WebDash::LogType::WARN, "Action cache: entry " + name + " is corrupt. Dropped.");
+
+        std::error_code ec;
+        std::filesystem::remove_all(path, ec);
+        _total_size -= it->second.size;
+        _entries.erase(it);
+        _Save();
+        return nullopt;
+    }
+
+    size_t index = 0;
+    for (const json& file : restore_files ? meta["files"] : json::array()) {
+        const std::filesystem::path destination = file.get<std::string>();
+
+        std::error_code ec;
+        std::filesystem::create_directories(destination.parent_path(), ec);
+        std::filesystem::copy_file(path / "files" / to_string(index++), destination, std::filesystem::copy_options::overwrite_existing, ec);
+
+        if (ec) {
+            WEBDASH_LOG(WebDash::LogType::WARN, "Action cache: failed restoring " + destination.string() + ": " + ec.message());
+            return nullopt;
+        }
+    }
+
+    it->second.last_used = NowMs();
+    _Save();
+
+    WEBDASH_LOG(WebDash::LogType::DEBUG, "Action cache: hit " + name);
+    return ret;
+}
+
+void WebDashActionCache::Store(uint64_t key, const webdash::RunReturn& result, const vector<string>& outputs, uint64_t capacity) {
+    const string name = webdash::ToHex(key);
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    // Assembled aside and renamed into place, so that readers never see a partial entry.
+    const std::filesystem::path staging = _GetRoot() / (name + kStagingSuffix + to_string(getpid()));
+    std::error_code ec;
+    std::filesystem::remove_all(staging, ec);
+    std::filesystem::create_directories(staging / "files", ec);
+
+    auto abandon = [&](const string& reason) {
+        WEBDASH_LOG(WebDash::LogType::WARN, "Action cache: not storing " + name + ": " + reason);
+        std::error_code ignored;
+        std::filesystem::remove_all(staging, ignored);
+    };
+
+    if (ec)
+        return abandon(ec.message());
+
+    uint64_t size = result.output.size();
+
+    json meta;
+    meta["return_code"] = result.return_code;
+    meta["chunks"] = json::array();
+    for (const webdash::OutputChunk& chunk : result.chunks) {
+        const int64_t time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(chunk.time.time_since_epoch()).count();
+        meta["chunks"].push_back({ static_cast<int>(chunk.stream), chunk.offset, chunk.length, time_ms });
+    }
+
+    meta["stages"] = json::array();
+    for (const webdash::StageResult& stage : result.stages)
+        meta["stages"].push_back({ stage.command, stage.return_code });
+
+    meta["files"] = json::array();
+    for (size_t i = 0; i < outputs.size(); ++i) {
+        std::filesystem::copy_file(outputs[i], staging / "files" / to_string(i), ec);
+        if (ec)
+            return abandon("failed copying " + outputs[i] + ": " + ec.message());
+
+        size += std::filesystem::file_size(outputs[i], ec);
+        meta["files"].push_back(outputs[i]);
+    }
+
+    if (size > capacity)
+        return abandon("larger than the cache");
+
+    {
+        ofstream output_stream(staging / "output", ios::binary);
+        output_stream.write(result.output.data(), result.output.size());
+
+        ofstream meta_stream(staging / "result.json");
+        meta_stream << meta.dump();
+
+        if (!output_stream || !meta_stream)
+            return abandon("write error");
+    }
+
+    IndexLock index_lock(_root / kLockFile);
+    if (!index_lock.IsLocked())
+        return abandon("the index is not accessible");
+
+    _Load();
+
+    const std::filesystem::path path = _GetEntryPath(name);
+    std::filesystem::remove_all(path, ec);
+    std::filesystem::rename(staging, path, ec);
+    if (ec)
+        return abandon(ec.message());
+
+    auto it = _entries.find(name);
+    if (it != _entries.end())
+        _total_size -= it->second.size;
+
+    _entries[name] = Entry { size, NowMs() };
+    _total_size += size;
+
+    _Evict(capacity);
+    _Save();
+}
+
+std::filesystem::path WebDashActionCache::_GetRoot() {
+    if (_root.empty()) {
+        _root = MyWorld().GetPersistenteStoragePath() / kCacheDirectory;
+
+        std::error_code ec;
+        std::filesystem::create_directories(_root, ec);
+    }
+
+    return _root;
+}
+
+void WebDashActionCache::_Load() {
+    ifstream in(_root / kIndexFile, ios::binary);
+    json index = json::parse(in, nullptr, false);
+
+    // Other invocations may have stored or evicted entries meanwhile. Unless it is unreadable,
+    // the index on disk replaces what this process knows.
+    const bool is_readable = !index.is_discarded() && index.is_object();
+    if (is_readable) {
+        _entries.clear();
+        _total_size = 0;
+
+        for (auto& [name, entry] : index.items()) {
+            // Entries may have been removed by hand.
+            if (!std::filesystem::exists(_GetEntryPath(name)))
+                continue;
+
+            _entries[name] = Entry { entry.value("size", (uint64_t)0), entry.value("last_used", (int64_t)0) };
+            _total_size += _entries[name].size;
+        }
+    }
+
+    // Entries whose process crashed before updating the index still take space.
+    if (!_is_loaded || !is_readable) {
+        _is_loaded = true;
+        if (_Adopt())
+            _Save();
+    }
+}
+
+bool WebDashActionCache::_Adopt() {
+    bool is_changed = false;
+
+    std::error_code ec;
+    for (const auto& item : std::filesystem::directory_iterator(_root, ec)) {
+        if (!item.is_directory(ec))
+            continue;
+
+        const string name = item.path().filename().string();
+
+        // Staging directories of running processes are left alone.
+        const size_t staging = name.find(kStagingSuffix);
+        if (staging != string::npos) {
+            const pid_t pid = atoi(name.c_str() + staging + kStagingSuffix.size());
+            if (pid > 0 && kill(pid, 0) != 0 && errno == ESRCH)
+                std::filesystem::remove_all(item.path(), ec);
+            continue;
+        }
+
+        if (_entries.count(name))
+            continue;
+
+        is_changed = true;
+
+        if (!std::filesystem::exists(item.path() / "result.json")) {
+            std::filesystem::remove_all(item.path(), ec);
+            continue;
+        }
+
+        uint64_t size = 0;
+        for (const auto& file : std::filesystem::recursive_directory_iterator(item.path(), ec)) {
+            if (file.is_regular_file(ec) && file.path().filename() != "result.json")
+                size += file.file_size(ec);
+        }
+
+        WEBDASH_LOG(WebDash::LogType::DEBUG, "Action cache: adopting unindexed entry " + name);
+
+        // Never used as far as we know: the first to be evicted.
+        _entries[name] = Entry { size, 0 };
+        _total_size += size;
+    }
+
+    return is_changed;
+}
+
+void WebDashActionCache::_Save() {
+    json index = json::object();
+    for (const auto& [name, entry] : _entries)
+        index[name] = { { "size", entry.size }, { "last_used", entry.last_used } };
+
+    // Written aside and renamed into place, so that a crash never leaves a truncated index.
+    const string path = (_root / kIndexFile).string();
+    const string staging_path = path + kStagingSuffix + to_string(getpid());
+    const int fd = open(staging_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    const bool is_written = fd >= 0 && WriteAll(fd, index.dump()) && fsync(fd) == 0;
+    if (fd >= 0)
+        close(fd);
+
+    if (!is_written || rename(staging_path.c_str(), path.c_str()) != 0) {
+        perror("WebDashActionCache::_Save!rename");
+        MyWorld().Log(WebDash::LogType::ERR, "Action cache: failed writing " + path);
+        unlink(staging_path.c_str());
+    }
+}
+
+void WebDashActionCache::_Evict(uint64_t capacity) {
+    while (_total_size > capacity && !_entries.empty()) {
+        auto oldest = _entries.begin();
+        for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+            if (it->second.last_used < oldest->second.last_used)
+                oldest = it;
+        }
+
+        WEBDASH_LOG(WebDash::LogType::DEBUG, "Action cache: evicting " + oldest->first);
+
+        std::error_code ec;
+        std::filesystem::remove_all(_GetEntryPath(oldest->first), ec);
+        _total_size -= oldest->second.size;
+        _entries.erase(oldest);
+    }
+}
+
+std::filesystem::path WebDashActionCache::_GetEntryPath(const string& key) const {
+    return _root / key;
+}
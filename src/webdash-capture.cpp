@@ -0,0 +1,200 @@
+#include "webdash-capture.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <vector>
+using namespace std;
+
+
+namespace {
+    // Matches the default /proc/sys/fs/pipe-max-size.
+    constexpr int kPipeSize = 1 << 20;
+
+    constexpr size_t kReadChunk = 256 * 1024;
+
+    // Reusable read buffer. One per thread, as several threads may capture concurrently.
+    char* GetReadBuffer() {
+        thread_local vector<char> buffer(kReadChunk);
+        return buffer.data();
+    }
+
+    bool WriteAt(int fd, const char* data, size_t len, off_t offset) {
+        for (size_t done = 0; done < len;) {
+            const ssize_t written = pwrite(fd, data + done, len - done, offset + done);
+            if (written < 0 && errno != EINTR)
+                return false;
+            if (written > 0)
+                done += written;
+        }
+        return true;
+    }
+}
+
+webdash::FileSink::FileSink(const string& path) {
+    _fd = open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+
+    const off_t end = _fd >= 0 ? lseek(_fd, 0, SEEK_END) : 0;
+    _offset = end < 0 ? 0 : end;
+}
+
+webdash::FileSink::~FileSink() {
+    if (_fd >= 0)
+        close(_fd);
+}
+
+void webdash::FileSink::Write(const string& taskid, Stream stream, const char* data, size_t len) {
+    /* unused */ (void) taskid;
+    /* unused */ (void) stream;
+
+    if (_fd >= 0)
+        WriteAt(_fd, data, len, Reserve(len));
+}
+
+webdash::RingBufferSink::RingBufferSink(size_t capacity) : _buffer(capacity) {
+}
+
+void webdash::RingBufferSink::Write(const string& taskid, Stream stream, const char* data, size_t len) {
+    /* unused */ (void) taskid;
+    /* unused */ (void) stream;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    const size_t capacity = _buffer.size();
+    _total += len;
+
+    if (capacity == 0)
+        return;
+
+    // Only the tail of an oversized chunk survives anyway.
+    if (len > capacity) {
+        data += len - capacity;
+        len = capacity;
+    }
+
+    const size_t first = min(len, capacity - _head);
+    std::copy(data, data + first, _buffer.begin() + _head);
+    std::copy(data + first, data + len, _buffer.begin());
+
+    _head = (_head + len) % capacity;
+}
+
+string webdash::RingBufferSink::GetContents() {
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_total < _buffer.size())
+        return string(_buffer.begin(), _buffer.begin() + _total);
+
+    string ret(_buffer.begin() + _head, _buffer.end());
+    ret.append(_buffer.begin(), _buffer.begin() + _head);
+    return ret;
+}
+
+size_t webdash::RingBufferSink::GetTotalSize() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _total;
+}
+
+void webdash::EnlargePipe(int fd) {
+    fcntl(fd, F_SETPIPE_SZ, kPipeSize);
+}
+
+webdash::PipeCapture::PipeCapture(int fd, Stream stream, RunReturn* ret, OutputSink* sink, const string& taskid)
+    : _fd(fd), _stream(stream), _ret(ret), _sink(sink), _taskid(taskid) {
+    FileSink* file = sink != nullptr ? sink->AsFileSink() : nullptr;
+
+    // Splicing only pays off if nobody needs the bytes in user space.
+    _file = (ret == nullptr && file != nullptr && file->IsOpen()) ? file : nullptr;
+}
+
+webdash::PipeCapture::Status webdash::PipeCapture::Pump(size_t budget) {
+    if (_file != nullptr)
+        return _Splice(budget);
+
+    return _Read(budget);
+}
+
+webdash::PipeCapture::Status webdash::PipeCapture::_Read(size_t budget) {
+    char* buffer = GetReadBuffer();
+
+    for (size_t consumed = 0; consumed < budget;) {
+        const ssize_t len = read(_fd, buffer, kReadChunk);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return Status::Open;
+            return Status::Error;
+        }
+
+        if (len == 0)
+            return Status::Eof;
+
+        if (_ret != nullptr) {
+            _ret->chunks.push_back({ _stream, std::chrono::system_clock::now(), _ret->output.size(), (size_t)len });
+            _ret->output.append(buffer, len);
+        }
+
+        if (_sink != nullptr)
+            _sink->Write(_taskid, _stream, buffer, len);
+
+        consumed += len;
+    }
+
+    return Status::Open;
+}
+
+webdash::PipeCapture::Status webdash::PipeCapture::_Splice(size_t budget) {
+    for (size_t consumed = 0; consumed < budget;) {
+        int available = 0;
+        if (ioctl(_fd, FIONREAD, &available) < 0)
+            return Status::Error;
+
+        // Nothing buffered: either the writer is gone or we have to wait. read() tells which.
+        if (available == 0) {
+            char probe;
+            const ssize_t len = read(_fd, &probe, 1);
+            if (len == 0)
+                return Status::Eof;
+            if (len < 0)
+                return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? Status::Open : Status::Error;
+
+            _sink->Write(_taskid, _stream, &probe, 1);
+            consumed++;
+            continue;
+        }
+
+        const off_t offset = _file->Reserve(available);
+        for (ssize_t done = 0; done < available;) {
+            loff_t off = offset + done;
+            const ssize_t moved = splice(_fd, nullptr, _file->GetFd(), &off, available - done, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved < 0 && errno == EINTR)
+                continue;
+
+            if (moved <= 0) {
+                // Not supported by the target file system. Fill the reserved range the classic way
+                // (the pipe holds at least that much) and continue with read().
+                char* buffer = GetReadBuffer();
+                while (done < available) {
+                    const ssize_t len = read(_fd, buffer, min((size_t)(available - done), kReadChunk));
+                    if (len < 0 && errno == EINTR)
+                        continue;
+                    if (len <= 0 || !WriteAt(_file->GetFd(), buffer, len, offset + done))
+                        return Status::Error;
+                    done += len;
+                }
+
+                _file = nullptr;
+                return Status::Open;
+            }
+
+            done += moved;
+        }
+
+        consumed += available;
+    }
+
+    return Status::Open;
+}
@@ -0,0 +1,84 @@
+#include "webdash-config-image.hpp"
+
+#include <stdexcept>
+using namespace std;
+
+
+void webdash::ImageWriter::PutU32(uint32_t value) {
+    for (int i = 0; i < 4; ++i)
+        _data += (char)((value >> (8 * i)) & 0xff);
+}
+
+void webdash::ImageWriter::PutU64(uint64_t value) {
+    for (int i = 0; i < 8; ++i)
+        _data += (char)((value >> (8 * i)) & 0xff);
+}
+
+void webdash::ImageWriter::PutString(const string& value) {
+    PutU32(value.size());
+    _data += value;
+}
+
+void webdash::ImageWriter::PutStrings(const vector<string>& values) {
+    PutU32(values.size());
+    for (const string& value : values)
+        PutString(value);
+}
+
+void webdash::ImageWriter::PutOptionalString(const std::optional<string>& value) {
+    PutBool(value.has_value());
+    if (value.has_value())
+        PutString(value.value());
+}
+
+const char* webdash::ImageReader::_Take(size_t len) {
+    if (len > _size - _offset)
+        throw std::out_of_range("config image");
+
+    const char* ret = _data + _offset;
+    _offset += len;
+    return ret;
+}
+
+uint32_t webdash::ImageReader::GetU32() {
+    const unsigned char* bytes = (const unsigned char*)_Take(4);
+
+    uint32_t value = 0;
+    for (int i = 3; i >= 0; --i)
+        value = (value << 8) | bytes[i];
+    return value;
+}
+
+uint64_t webdash::ImageReader::GetU64() {
+    const unsigned char* bytes = (const unsigned char*)_Take(8);
+
+    uint64_t value = 0;
+    for (int i = 7; i >= 0; --i)
+        value = (value << 8) | bytes[i];
+    return value;
+}
+
+string webdash::ImageReader::GetString() {
+    const uint32_t len = GetU32();
+    return string(_Take(len), len);
+}
+
+vector<string> webdash::ImageReader::GetStrings() {
+    const uint32_t count = GetU32();
+
+    // Each string takes at least its length prefix; guards against absurd counts.
+    if (count > GetRemainingSize() / 4)
+        throw std::out_of_range("config image");
+
+    vector<string> values;
+    values.reserve(count);
+    for (uint32_t i = 0; i < count; ++i)
+        values.push_back(GetString());
+    return values;
+}
+
+std::optional<string> webdash::ImageReader::GetOptionalString() {
+    if (!GetBool())
+        return nullopt;
+    return GetString();
+}
@@ -0,0 +1,68 @@
+#include "webdash-config-registry.hpp"
+#include "webdash-config.hpp"
+#include "webdash-core.hpp"
+
+#include <filesystem>
+#include <mutex>
+#include <sys/stat.h>
+using namespace std;
+
+
+/* static */ WebDashConfigRegistry& WebDashConfigRegistry::Get() {
+    static WebDashConfigRegistry registry;
+    return registry;
+}
+
+std::shared_ptr<WebDashConfig> WebDashConfigRegistry::Find(const string& path) {
+    string canonical;
+    {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        auto it = _canonical_paths.find(path);
+        if (it != _canonical_paths.end())
+            canonical = it->second;
+    }
+
+    if (canonical.empty()) {
+        std::error_code ec;
+        canonical = std::filesystem::weakly_canonical(path, ec).string();
+        if (ec || canonical.empty())
+            canonical = path;
+
+        std::unique_lock<std::shared_mutex> lock(_mutex);
+        _canonical_paths[path] = canonical;
+    }
+
+    // Taken before reading, so that a change while loading is noticed on the next lookup.
+    struct stat st;
+    if (stat(canonical.c_str(), &st) != 0)
+        return nullptr;
+
+    // Substitutions and environment of the tasks come from definitions.json, so a new snapshot
+    // of it outdates the config as well.
+    const Signature signature { st.st_dev, st.st_ino, st.st_size, st.st_mtim, MyWorld().GetDefinitions() };
+
+    {
+        std::shared_lock<std::shared_mutex> lock(_mutex);
+        auto it = _entries.find(canonical);
+        if (it != _entries.end() && it->second.signature == signature)
+            return it->second.config;
+    }
+
+    WEBDASH_LOG(WebDash::LogType::DEBUG, "Config registry: loading " + canonical);
+
+    // Loaded without holding the lock. Concurrent lookups of the same config may both load it;
+    // the first one to finish is kept. Failures are kept too, until the file changes.
+    auto config = std::make_shared<WebDashConfig>(canonical);
+    if (!config->IsLoaded())
+        config = nullptr;
+
+    std::unique_lock<std::shared_mutex> lock(_mutex);
+
+    auto it = _entries.find(canonical);
+    if (it != _entries.end() && it->second.signature == signature)
+        return it->second.config;
+
+    _entries[canonical] = Entry { signature, config };
+
+    return config;
+}
@@ -2,11 +2,17 @@
 #include "webdash-config-task.hpp"
 #include "webdash-core.hpp"
 #include "webdash-config.hpp"
+#include "webdash-capture.hpp"
+#include "webdash-executor.hpp"
+#include "webdash-fingerprint.hpp"
+#include "webdash-process.hpp"
+#include "webdash-run-state.hpp"
+#include "webdash-supervisor.hpp"
+#include "webdash-worker-pool.hpp"
 
 #include <cstdio>
 #include <unistd.h>
 #include <fcntl.h>
-#include <sys/wait.h>
 #include <errno.h>
 #include <sstream>
 #include <ctime>
@@ -15,12 +21,15 @@ using namespace std;
 
 
 WebDashConfigTask::WebDashConfigTask(WebDashConfig* config, string taskid, json task_config) {
-    MyWorld().Log(WebDash::LogType::DEBUG, "Loading Task: " + taskid);
+    WEBDASH_LOG(WebDash::LogType::DEBUG, "Loading Task: " + taskid);
 
     this->_config_path = config->GetPath();
     this->_taskid = taskid;
     this->_is_valid = true;
 
+    // Taken before any lookup below adds missing fields to {task_config}.
+    this->_source_hash = webdash::Fnv1a(task_config.dump(), webdash::kFnv1aOffsetBasis);
+
     //
     // Parse the webdash.config.json file.
     //
@@ -35,10 +44,20 @@ WebDashConfigTask::WebDashConfigTask(WebDashConfig* config, string taskid, json
     }
 
     {
+        // An action is a command line, or { "pipeline": [ command lines ] }.
+        const auto get_stages = [](const json& action) {
+            if (!action.is_object())
+                return vector<string> { action.get<std::string>() };
+
+            const auto stages = action.at("pipeline").get<vector<string>>();
+            if (stages.empty())
+                throw std::invalid_argument("pipeline");
+            return stages;
+        };
+
         bool has_action = false;
         try {
-            const string action = task_config["action"].get<std::string>();
-            this->_actions.push_back(action);
+            this->_action_stages.push_back(get_stages(task_config["action"]));
             has_action = true;
         } catch (...) {
         }
@@ -47,7 +66,7 @@ WebDashConfigTask::WebDashConfigTask(WebDashConfig* config, string taskid, json
             json actions = task_config["actions"];
 
             for (auto action : actions) 
-                this->_actions.push_back(action.get<std::string>());
+                this->_action_stages.push_back(get_stages(action));
             has_action = true;
         } catch (...) {
         }
@@ -64,7 +83,7 @@ WebDashConfigTask::WebDashConfigTask(WebDashConfig* config, string taskid, json
         for (auto dependency : dependencies) 
             this->_dependencies.push_back(dependency.get<std::string>());
     } catch (...) {
-        MyWorld().Log(WebDash::LogType::WARN, "T| " + taskid + ": field missing [dependencies].");
+        WEBDASH_LOG(WebDash::LogType::WARN, "T| " + taskid + ": field missing [dependencies].");
     }
 
     
@@ -72,260 +91,485 @@ WebDashConfigTask::WebDashConfigTask(WebDashConfig* config, string taskid, json
         const string frequency = task_config["frequency"].get<std::string>();
         this->_frequency = frequency;
     } catch (...) {
-        MyWorld().Log(WebDash::LogType::WARN, "T| " + taskid + ": field missing [frequency].");
+        WEBDASH_LOG(WebDash::LogType::WARN, "T| " + taskid + ": field missing [frequency].");
     }
 
     try {
         const string when = task_config["when"].get<std::string>();
         this->_when_to_execute = when;
     } catch (...) {
-        MyWorld().Log(WebDash::LogType::WARN, "T| " + taskid + ": field missing [when] (remove this?).");
+        WEBDASH_LOG(WebDash::LogType::WARN, "T| " + taskid + ": field missing [when] (remove this?).");
     }
 
     try {
         const string wdir = task_config["wdir"].get<std::string>();
         this->_wdir = wdir;
     } catch (...) {
-        MyWorld().Log(WebDash::LogType::WARN, "T| " + taskid + ": no working directory (wdir) given.");
+        WEBDASH_LOG(WebDash::LogType::WARN, "T| " + taskid + ": no working directory (wdir) given.");
     }
 
     try {
         const bool val = task_config["notify-dashboard"].get<bool>();
         this->_notify_dashboard = val;
     } catch (...) {
-        MyWorld().Log(WebDash::LogType::WARN, "T| " + taskid + ": dashboard notification not specified.");
+        WEBDASH_LOG(WebDash::LogType::WARN, "T| " + taskid + ": dashboard notification not specified.");
+    }
+
+    // Optional: maximum runtime of each action, in milliseconds.
+    if (task_config.contains("timeout")) {
+        try {
+            const json timeout = task_config["timeout"];
+            const double ms = timeout.is_string() ? stod(timeout.get<std::string>()) : timeout.get<double>();
+            if (ms <= 0)
+                throw std::invalid_argument("timeout");
+            this->_timeout = std::chrono::milliseconds((long long)ms);
+        } catch (...) {
+            MyWorld().Log(WebDash::LogType::ERR, "T| " + taskid + ": malformed [timeout]. Ignored.");
+        }
+    }
+
+    // Optional: files the actions read and write (glob patterns). Enables skipping up-to-date tasks.
+    for (const auto& [field, target] : { make_pair("inputs", &_inputs), make_pair("outputs", &_outputs) }) {
+        if (!task_config.contains(field))
+            continue;
+
+        try {
+            for (auto pattern : task_config[field])
+                target->push_back(pattern.get<std::string>());
+        } catch (...) {
+            MyWorld().Log(WebDash::LogType::ERR, "T| " + taskid + ": malformed [" + field + "]. Ignored.");
+            target->clear();
+        }
+    }
+
+    // Optional: results may be taken from the action cache. Requires declared inputs.
+    if (task_config.contains("cache")) {
+        try {
+            this->_use_cache = task_config["cache"].get<bool>();
+        } catch (...) {
+            MyWorld().Log(WebDash::LogType::ERR, "T| " + taskid + ": malformed [cache]. Ignored.");
+        }
+
+        if (_use_cache && _inputs.empty()) {
+            WEBDASH_LOG(WebDash::LogType::WARN, "T| " + taskid + ": [cache] requires [inputs]. Ignored.");
+            _use_cache = false;
+        }
+    }
+
+    // Optional: abort the whole run as soon as a dependency or action of this task fails.
+    if (task_config.contains("fail-fast")) {
+        try {
+            this->_fail_fast = task_config["fail-fast"].get<bool>();
+        } catch (...) {
+            MyWorld().Log(WebDash::LogType::ERR, "T| " + taskid + ": malformed [fail-fast]. Ignored.");
+        }
     }
 
     //
     // Apply all keyword substitutions.
     //
 
-    auto defs = config->GetAllDefinitions();
-    _name = ApplySubstitutions(_name, defs);
+    const webdash::Substitutions& substitutions = config->GetSubstitutions();
+
+    // Remembered for reloads: a task is only rebuilt if its entry or one of these definitions changed.
+    vector<bool> is_referenced(substitutions.GetSize(), false);
+    const auto substitute = [&](string& field) {
+        const auto tmpl = substitutions.Parse(field);
+        substitutions.CollectReferences(tmpl, is_referenced);
+        field = substitutions.Expand(tmpl);
+    };
 
-    for (auto& action : _actions) {
-        action = ApplySubstitutions(action, defs);
+    substitute(_name);
+
+    for (auto& stages : _action_stages) {
+        string action;
+        for (auto& stage : stages) {
+            substitute(stage);
+            action += (action.empty() ? "" : " | ") + stage;
+        }
+
+        _actions.push_back(action);
     }
 
     for (auto& dependency : _dependencies) {
-        dependency = ApplySubstitutions(dependency, defs);
+        substitute(dependency);
     }
 
     if (_wdir.has_value()) {
-        _wdir = ApplySubstitutions(_wdir.value(), defs);
+        substitute(_wdir.value());
     }
-}
 
-bool is_number(const std::string& s) {
-    char* end = 0;
-    const double val = strtod(s.c_str(), &end);
-    return end != s.c_str() && *end == '\0' && val != HUGE_VAL;
-}
-
-bool WebDashConfigTask::ShouldExecuteTimewise(webdash::RunConfig config) {
-    const auto diff = std::chrono::high_resolution_clock::now() - _last_exec_time;
-    const auto diff_h = duration_cast<hours>(diff).count();
-    const auto diff_ms = duration_cast<milliseconds>(diff).count();
+    for (auto& pattern : _inputs) {
+        substitute(pattern);
+    }
 
-    // We expect frequency because of <run_only_with_frequency> but didn't get any.
-    if (config.run_only_with_frequency && !_frequency.has_value())
-        return false;
+    for (auto& pattern : _outputs) {
+        substitute(pattern);
+    }
 
-    bool enough_time_passed = true;
-    if (_frequency.has_value()) {
-        string freqv = _frequency.value();
+    for (size_t i = 0; i < is_referenced.size(); ++i) {
+        if (is_referenced[i])
+            _referenced_definitions.push_back(substitutions.GetKey(i));
+    }
 
-        //
-        // Malformed frequency field?
-        //
+    // Split once here; launching hands the prepared argv to the spawn call.
+    for (size_t i = 0; i < _actions.size(); ++i) {
+        webdash::Pipeline pipeline;
+        pipeline.text = _actions[i];
+
+        for (const string& stage : _action_stages[i]) {
+            string error;
+            auto command = webdash::Command::Parse(stage, &error);
+            if (!command.has_value()) {
+                MyWorld().Log(WebDash::LogType::ERR, "T| " + taskid + ": malformed action `" + stage + "`: " + error);
+                _is_valid = false;
+                command.emplace();
+            }
 
-        if (freqv != "daily" && !is_number(freqv)) {
-            MyWorld().Log(WebDash::LogType::INFO, "Malformed frequency field. Skipped.");
-            enough_time_passed = false;
+            pipeline.stages.push_back(std::move(command.value()));
         }
 
-        if (diff_h < 24 && freqv == "daily") {
-            enough_time_passed = false;
-        } else if (diff_ms && is_number(freqv) && (diff_ms < stod(freqv))) {
-            enough_time_passed = false;
-        }
+        _commands.push_back(std::move(pipeline));
     }
 
-    if (enough_time_passed == false) {
-        return false;
+    _environment = config->GetEnvironment();
+
+    // Parsed once here, evaluated on every run (or by the scheduler).
+    _schedule = webdash::Schedule::Compile(_frequency, _when_to_execute);
+    if (!_schedule.IsValid())
+        MyWorld().Log(WebDash::LogType::ERR, "T| " + taskid + ": malformed [frequency] '" + _frequency.value_or("") + "'. The task is never executed.");
+
+}
+
+WebDashConfigTask::WebDashConfigTask(WebDashConfig* config, webdash::ImageReader& reader) {
+    _config_path = config->GetPath();
+    _environment = config->GetEnvironment();
+
+    _taskid = reader.GetString();
+    _name = reader.GetString();
+    _is_valid = reader.GetBool();
+
+    const uint32_t action_count = reader.GetU32();
+    for (uint32_t i = 0; i < action_count; ++i) {
+        webdash::Pipeline pipeline;
+        pipeline.text = reader.GetString();
+
+        vector<string> stages;
+        const uint32_t stage_count = reader.GetU32();
+        for (uint32_t j = 0; j < stage_count; ++j) {
+            stages.push_back(reader.GetString());
+            pipeline.stages.push_back(webdash::Command::FromArgv(reader.GetStrings(), stages.back()));
+        }
+
+        _actions.push_back(pipeline.text);
+        _action_stages.push_back(std::move(stages));
+        _commands.push_back(std::move(pipeline));
     }
 
-    if (_when_to_execute == "new-day") {
-        std::time_t _time_last  = std::chrono::system_clock::to_time_t(_last_exec_time);
-        std::time_t _time_today = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    _dependencies = reader.GetStrings();
+    _frequency = reader.GetOptionalString();
+    _when_to_execute = reader.GetString();
+    _wdir = reader.GetOptionalString();
+    _notify_dashboard = reader.GetBool();
+
+    if (reader.GetBool())
+        _timeout = std::chrono::milliseconds(reader.GetU64());
 
-        const auto tm_last  = gmtime(&_time_last);
-        const auto tm_today = gmtime(&_time_today);
+    _inputs = reader.GetStrings();
+    _outputs = reader.GetStrings();
+    _use_cache = reader.GetBool();
+    _fail_fast = reader.GetBool();
+    _source_hash = reader.GetU64();
+    _referenced_definitions = reader.GetStrings();
 
-        const int day_last  = tm_last->tm_mday;
-        const int day_today = tm_today->tm_mday;
+    _schedule = webdash::Schedule::Compile(_frequency, _when_to_execute);
+}
+
+void WebDashConfigTask::WriteImage(webdash::ImageWriter& writer) const {
+    writer.PutString(_taskid);
+    writer.PutString(_name);
+    writer.PutBool(_is_valid);
+
+    writer.PutU32(_commands.size());
+    for (size_t i = 0; i < _commands.size(); ++i) {
+        writer.PutString(_commands[i].text);
+        writer.PutU32(_commands[i].stages.size());
 
-        if (day_last != day_today) {
-            return true;
+        for (size_t j = 0; j < _commands[i].stages.size(); ++j) {
+            const webdash::Command& command = _commands[i].stages[j];
+            writer.PutString(_action_stages[i][j]);
+            writer.PutStrings(vector<string>(command.GetArgv(), command.GetArgv() + command.GetArgc()));
         }
     }
-    
 
-    return true;
+    writer.PutStrings(_dependencies);
+    writer.PutOptionalString(_frequency);
+    writer.PutString(_when_to_execute);
+    writer.PutOptionalString(_wdir);
+    writer.PutBool(_notify_dashboard);
+
+    writer.PutBool(_timeout.has_value());
+    if (_timeout.has_value())
+        writer.PutU64(_timeout.value().count());
+
+    writer.PutStrings(_inputs);
+    writer.PutStrings(_outputs);
+    writer.PutBool(_use_cache);
+    writer.PutBool(_fail_fast);
+    writer.PutU64(_source_hash);
+    writer.PutStrings(_referenced_definitions);
+}
+
+void WebDashConfigTask::_LoadRunState() {
+    if (_is_run_state_loaded)
+        return;
+
+    _is_run_state_loaded = true;
+
+    // Runs of earlier invocations count too.
+    const auto state = WebDashRunStateStore::Get().Find(_taskid);
+    if (state.has_value())
+        _last_exec_time = std::chrono::system_clock::time_point(std::chrono::milliseconds(state->last_start));
+}
+
+bool WebDashConfigTask::ShouldExecuteTimewise(webdash::RunConfig config) {
+    std::lock_guard<std::mutex> lock(*_run_mutex);
+    return _IsDue(config);
+}
+
+bool WebDashConfigTask::_IsDue(const webdash::RunConfig& config) {
+    // We expect frequency because of <run_only_with_frequency> but didn't get any.
+    if (config.run_only_with_frequency && !_schedule.IsTimed())
+        return false;
+
+    _LoadRunState();
+    return _schedule.NextDue(_last_exec_time) <= std::chrono::system_clock::now();
+}
+
+std::chrono::system_clock::time_point WebDashConfigTask::GetNextDue() {
+    std::lock_guard<std::mutex> lock(*_run_mutex);
+    _LoadRunState();
+    return _schedule.NextDue(_last_exec_time);
 }
 
 // wsl.exe -- source ~/.profile && webdash install
 webdash::RunReturn WebDashConfigTask::Run(webdash::RunConfig config, std::string action) {
+    return RunAsync(config, action).Wait();
+}
+
+webdash::TaskHandle WebDashConfigTask::RunAsync(webdash::RunConfig config, std::string action) {
+    string error;
+    const auto command = webdash::Command::Parse(action, &error);
+    if (!command.has_value()) {
+        MyWorld().Log(WebDash::LogType::ERR, "T| " + _taskid + ": malformed action `" + action + "`: " + error);
+
+        webdash::RunReturn retval;
+        retval.return_code = -1;
+        return webdash::TaskHandle::Completed(retval);
+    }
+
+    return RunAsync(config, webdash::Pipeline { { command.value() }, action });
+}
+
+webdash::TaskHandle WebDashConfigTask::RunAsync(webdash::RunConfig config, const webdash::Pipeline& pipeline) {
     webdash::RunReturn retval;
-    _times_called++;
+    {
+        std::lock_guard<std::mutex> lock(*_run_mutex);
+        _times_called++;
+    }
+
+    const string& action = pipeline.text;
+
+    WEBDASH_LOG(WebDash::LogType::DEBUG, "Executing: " + this->_taskid);
+    WEBDASH_LOG(WebDash::LogType::DEBUG, "    => " + action);
+
+    //
+    // Everything the child needs was prepared at load. The child only execs.
+    //
 
-    MyWorld().Log(WebDash::LogType::DEBUG, "Executing: " + this->_taskid);
-    MyWorld().Log(WebDash::LogType::DEBUG, "    => " + action);
+    vector<webdash::LaunchSpec> stages;
+    for (const webdash::Command& command : pipeline.stages) {
+        if (command.GetArgc() == 0) {
+            MyWorld().Log(WebDash::LogType::ERR, "T| " + _taskid + ": empty action.");
+            retval.return_code = -1;
+            return webdash::TaskHandle::Completed(retval);
+        }
 
-    cout << "Forking... " << endl;
+        webdash::LaunchSpec spec;
+        spec.command = command;
+        spec.environment = _environment;
+        spec.wdir = _wdir;
+        stages.push_back(std::move(spec));
+    }
 
-    int filedes[2];
-    // We create a pipe to be shared with two processes.
-    if (pipe(filedes) == -1) {
-        perror("pipe");
-        exit(1);
+    if (stages.empty()) {
+        MyWorld().Log(WebDash::LogType::ERR, "T| " + _taskid + ": empty action.");
+        retval.return_code = -1;
+        return webdash::TaskHandle::Completed(retval);
     }
 
-    // Close pipe automatically after child done calling exec.
-    if (fcntl(filedes[0], F_SETFD, FD_CLOEXEC) == -1) {
-        perror("fcntl");
-        exit(1);
+    {
+        std::stringstream banner;
+        banner << "-----------------" << endl;
+        banner << "TASKID: " << _taskid << endl;
+        banner << "CWD:    " << (_wdir.has_value() ? std::filesystem::path(_wdir.value()) : std::filesystem::current_path()) << endl;
+        banner << "CALL:   `" << action << "`" << endl;
+        banner << "-----------------" << endl;
+        cout << banner.str() << flush;
     }
 
-    const pid_t pid = fork();
-    if (pid == 0) {
-        if (_wdir.has_value()) {
-            if (chdir(_wdir.value().c_str()) != 0) {
-                perror ("WebDashConfigTask::Run!chdir");
-                MyWorld().Log(WebDash::LogType::ERR, "Failed to set cwd to: " + _wdir.value());
-                exit(1);
-            }
-            MyWorld().Log(WebDash::LogType::DEBUG, "Working directory set to: " + _wdir.value());
-        }
+    webdash::TaskHandle handle;
 
-        std::istringstream iss(action.c_str());
-        std::vector<std::string> execParts(std::istream_iterator<std::string>{iss},
-                                           std::istream_iterator<std::string>());
-
-        const char **paramList = new const char*[execParts.size() + 1];
-        for (unsigned int i = 0; i < execParts.size(); ++i)
-            paramList[i] = execParts[i].c_str();
-        paramList[execParts.size()] = NULL;
-
-        // child
-        cout << "-----------------" << endl;
-        cout << "TASKID: " << _taskid << endl;
-        cout << "CWD:    " << std::filesystem::current_path() << endl;
-        cout << "CALL:   `" << paramList[0];
-        for (unsigned int i = 1; i < execParts.size(); ++i) {
-            cout << " " << execParts[i];
-        }
-        cout << "`" << endl;
-        cout << "-----------------" << endl;
-
-        {
-            // If we are to redirect output to a string, create a copy of filedes[1] to STDOUT_FILENO (standard output).
-            if (config.redirect_output_to_str) {
-                while ((dup2(filedes[1], STDOUT_FILENO) == -1) && (errno == EINTR)) {}
-                while ((dup2(filedes[1], STDERR_FILENO) == -1) && (errno == EINTR)) {}
-            }
+    if (!config.workers.empty()) {
+        webdash::RemoteAction remote;
+        remote.stages = pipeline.stages;
+        remote.wdir = _wdir;
+        remote.environment = _environment->GetAdditions();
+        remote.timeout = _timeout;
 
-            // Close now children copies. We don't need them. We only used them to share our standard output with filedes[1] (which parent still utilizes).
-            close(filedes[1]);
-            close(filedes[0]);
-        }
+        const uint64_t id = WebDashWorkerPool::Get().Launch(config.workers, remote, config.redirect_output_to_str, config.output_sink, _taskid,
+            [handle](webdash::RunReturn ret) { handle.Complete(std::move(ret)); });
 
-        if (execvp(paramList[0], (char**)paramList) < 0) {
-            perror ("WebDashConfigTask::Run!execvp");
+        if (id == 0) {
+            MyWorld().Log(WebDash::LogType::ERR, "T| " + _taskid + ": failed to run `" + action + "` on a worker.");
+            retval.return_code = 1;
+            return webdash::TaskHandle::Completed(retval);
         }
 
-        exit(1);
-    } else if (pid > 0) {
-        close(filedes[1]);
-
-        // parent
-        if (config.redirect_output_to_str) {
-            retval.output = "";
-            while (1) {
-                char buffer[43];
-                int len = read(filedes[0], buffer, 42);
-                if ( len < 0 ) {
-                    if (errno == EINTR) {
-                        continue;
-                    } else {
-                        perror("read");
-                        close(filedes[0]);
-                        exit(1);
-                    }
-                } else if ( len == 0 ) {
-                    break;
-                } else {
-                    std::string data(buffer, len);
-                    retval.output += data;
-                }
-            }
-        }
+        handle.SetCanceller([id]() { WebDashWorkerPool::Get().Terminate(id); });
 
-        close(filedes[0]);
+        return handle;
     }
 
-    int status;
-    const pid_t wpid = waitpid(pid, &status, 0); // wait for child to finish before exiting
-    
-    retval.return_code = wpid == pid && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
-    return retval;
+    // The supervisor drains the output, enforces the timeout and reaps the child on its event loop.
+    const uint64_t child = WebDashSupervisor::Get().Launch(std::move(stages), config.redirect_output_to_str, config.output_sink, _taskid, _timeout,
+        [handle](webdash::RunReturn ret) { handle.Complete(std::move(ret)); });
+
+    if (child == 0) {
+        perror("WebDashConfigTask::Run!spawn");
+        MyWorld().Log(WebDash::LogType::ERR, "T| " + _taskid + ": failed to spawn `" + action + "`" +
+                      (_wdir.has_value() ? " in " + _wdir.value() : "") + ".");
+
+        retval.return_code = 1;
+        return webdash::TaskHandle::Completed(retval);
+    }
+
+    handle.SetCanceller([child]() { WebDashSupervisor::Get().Terminate(child); });
+
+    return handle;
 }
 
-webdash::RunReturn WebDashConfigTask::Run(webdash::RunConfig config) {
-    webdash::RunReturn ret;
+std::optional<webdash::TaskHandle> WebDashConfigTask::Claim(webdash::TaskHandle run) {
+    std::lock_guard<std::mutex> lock(*_run_mutex);
 
-    if (!ShouldExecuteTimewise(config)) {
+    if (_in_flight.has_value() && !_in_flight->Poll())
+        return _in_flight;
+
+    _in_flight = run;
+    return nullopt;
+}
+
+bool WebDashConfigTask::BeginRun(webdash::RunConfig config) {
+    std::lock_guard<std::mutex> lock(*_run_mutex);
+
+    if (!_IsDue(config)) {
         if (_print_skip_has_happened == false) {
-            MyWorld().Log(WebDash::LogType::DEBUG, "Skipping: " + this->_taskid);
-            MyWorld().Log(WebDash::LogType::DEBUG, "Was executed XYZ milliseconds ago.");
-            MyWorld().Log(WebDash::LogType::DEBUG, "....ommitting further similar reports until next execution passed.");
+            WEBDASH_LOG(WebDash::LogType::DEBUG, "Skipping: " + this->_taskid);
+            WEBDASH_LOG(WebDash::LogType::DEBUG, "Was executed XYZ milliseconds ago.");
+            WEBDASH_LOG(WebDash::LogType::DEBUG, "....ommitting further similar reports until next execution passed.");
             _print_skip_has_happened = true;
         }
 
-        return ret;
+        return false;
     }
 
     _print_skip_has_happened = false;
-    _last_exec_time = std::chrono::high_resolution_clock::now();
+    _last_exec_time = std::chrono::system_clock::now();
+    WebDashRunStateStore::Get().RecordStart(_taskid, _last_exec_time);
 
     if (_notify_dashboard) {
         myworld::notify(_taskid);
     }
 
-    for (int i = 0; i < (int)_dependencies.size(); ++i) {
-        auto task = config.TaskRetriever(_dependencies[i]);
+    return true;
+}
 
-        if (task.has_value()) {
-            auto ret_sub = task.value().Run(config);
-            ret.output += ret_sub.output;
-            ret.return_code |= ret_sub.return_code;
-        }
+uint64_t WebDashConfigTask::_GetDefinitionHash() const {
+    // Anything that changes what the actions do invalidates stored fingerprints.
+    uint64_t hash = webdash::kFnv1aOffsetBasis;
+    for (const auto* list : { &_actions, &_inputs, &_outputs }) {
+        for (const string& entry : *list)
+            hash = webdash::Fnv1a(entry + '\0', hash);
+        hash = webdash::Fnv1a("\n", hash);
     }
 
-    for (int i = 0; i < (int)_actions.size(); ++i) {
-        const string action = _actions[i];
+    return webdash::Fnv1a(_wdir.value_or(""), hash);
+}
 
-        auto maybesubtask = config.TaskRetriever(action);
-        if (maybesubtask.has_value()) {
-            auto ret_sub = maybesubtask.value().Run(config);
-            ret.output += ret_sub.output;
-            ret.return_code |= ret_sub.return_code;
-        } else {
-            auto ret_sub = Run(config, action);
-            ret.output += ret_sub.output;
-            ret.return_code |= ret_sub.return_code;
-        }
+bool WebDashConfigTask::IsUpToDate() const {
+    if (!HasFingerprints())
+        return false;
+
+    const string base = _wdir.value_or(std::filesystem::current_path().string());
+    return WebDashFingerprintStore::Get().IsUpToDate(_taskid, _GetDefinitionHash(),
+                                                     webdash::ExpandGlobs(_inputs, base),
+                                                     webdash::ExpandGlobs(_outputs, base));
+}
+
+std::optional<uint64_t> WebDashConfigTask::GetCacheKey() const {
+    if (!_use_cache)
+        return nullopt;
+
+    // The environment the actions get, which is that of the definitions the config was loaded with.
+    uint64_t key = _GetDefinitionHash();
+    if (_environment) {
+        for (const auto& [name, value] : _environment->GetAdditions())
+            key = webdash::Fnv1a(name + '=' + value + '\0', key);
+    }
+
+    // Contents are hashed along with the paths, so renaming an input changes the key too.
+    const string base = _wdir.value_or(std::filesystem::current_path().string());
+    for (const string& path : webdash::ExpandGlobs(_inputs, base)) {
+        const auto hash = webdash::HashFile(path);
+        if (!hash.has_value())
+            return nullopt;
+
+        key = webdash::Fnv1a(path + '\0' + webdash::ToHex(hash.value()), key);
     }
 
-    return ret;
+    return key;
+}
+
+vector<string> WebDashConfigTask::GetOutputFiles() const {
+    const string base = _wdir.value_or(std::filesystem::current_path().string());
+    return webdash::ExpandGlobs(_outputs, base);
+}
+
+void WebDashConfigTask::UpdateFingerprints(const webdash::RunReturn& result) const {
+    if (!HasFingerprints())
+        return;
+
+    if (result.return_code != 0) {
+        WebDashFingerprintStore::Get().Invalidate(_taskid);
+        return;
+    }
+
+    const string base = _wdir.value_or(std::filesystem::current_path().string());
+    WebDashFingerprintStore::Get().Record(_taskid, _GetDefinitionHash(),
+                                          webdash::ExpandGlobs(_inputs, base),
+                                          webdash::ExpandGlobs(_outputs, base));
+}
+
+void WebDashConfigTask::EndRun(const webdash::RunReturn& result) {
+    WebDashRunStateStore::Get().RecordEnd(_taskid, std::chrono::system_clock::now(), result.return_code);
+}
+
+webdash::RunReturn WebDashConfigTask::Run(webdash::RunConfig config) {
+    return RunAsync(config).Wait();
+}
+
+webdash::TaskHandle WebDashConfigTask::RunAsync(webdash::RunConfig config) {
+    // Dependencies and actions (including nested tasks) are scheduled by the executor.
+    auto executor = std::make_shared<WebDashExecutor>(config);
+    return executor->Start({ this })[0];
 }
@@ -0,0 +1,232 @@
+#include "webdash-config-watcher.hpp"
+#include "webdash-config.hpp"
+#include "webdash-core.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+using namespace std;
+
+
+namespace {
+    // Saving a file often takes several events (e.g. truncate, write, rename). Events arriving
+    // within this time of each other are reported at once.
+    constexpr int kSettleMs = 50;
+
+    constexpr uint32_t kWatchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE | IN_ONLYDIR;
+
+    // How often removed directories are checked for having been recreated.
+    constexpr int kRestoreIntervalMs = 1000;
+
+    string Canonical(const string& path) {
+        std::error_code ec;
+        const string canonical = std::filesystem::weakly_canonical(path, ec).string();
+        return (ec || canonical.empty()) ? path : canonical;
+    }
+}
+
+WebDashConfigWatcher::WebDashConfigWatcher(std::function<void()> on_change) : _on_change(on_change) {
+    _inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    _stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (_inotify_fd < 0 || _stop_fd < 0) {
+        perror("WebDashConfigWatcher!inotify_init1");
+        return;
+    }
+
+    _definitions_path = Canonical(WebDashCore::Get().GetMyWorldRootDirectory() + "/definitions.json");
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _WatchDirectory(std::filesystem::path(_definitions_path).parent_path().string());
+    }
+
+    _thread = std::thread(&WebDashConfigWatcher::_Loop, this);
+}
+
+WebDashConfigWatcher::~WebDashConfigWatcher() {
+    if (_thread.joinable()) {
+        const uint64_t one = 1;
+        if (write(_stop_fd, &one, sizeof(one)) < 0)
+            perror("WebDashConfigWatcher!write");
+        _thread.join();
+    }
+
+    if (_inotify_fd >= 0)
+        close(_inotify_fd);
+    if (_stop_fd >= 0)
+        close(_stop_fd);
+}
+
+bool WebDashConfigWatcher::Watch(WebDashConfig* config) {
+    const string path = Canonical(config->GetPath());
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    if (_inotify_fd < 0)
+        return false;
+
+    _RestoreWatches();
+    if (!_WatchDirectory(std::filesystem::path(path).parent_path().string()))
+        return false;
+
+    _configs[path].push_back(config);
+    return true;
+}
+
+bool WebDashConfigWatcher::HasChanges() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return !_changed.empty();
+}
+
+bool WebDashConfigWatcher::Apply() {
+    unordered_set<string> changed;
+    unordered_map<string, vector<WebDashConfig*>> configs;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _RestoreWatches();
+        changed.swap(_changed);
+        configs = _configs;
+    }
+
+    if (changed.empty())
+        return false;
+
+    // A config only re-resolves the tasks referring to definitions that changed.
+    const bool has_definitions_changed = changed.count(_definitions_path) > 0;
+    for (const auto& [path, list] : configs) {
+        if (!has_definitions_changed && !changed.count(path))
+            continue;
+
+        for (WebDashConfig* config : list)
+            config->Reload();
+    }
+
+    return true;
+}
+
+bool WebDashConfigWatcher::_WatchDirectory(const string& directory) {
+    for (const auto& [wd, watched] : _directories) {
+        if (watched == directory)
+            return true;
+    }
+
+    const int wd = inotify_add_watch(_inotify_fd, directory.c_str(), kWatchMask);
+    if (wd < 0) {
+        MyWorld().Log(WebDash::LogType::ERR, "Config watcher: unable to watch " + directory + ": " + strerror(errno));
+        return false;
+    }
+
+    _directories[wd] = directory;
+    return true;
+}
+
+bool WebDashConfigWatcher::_RestoreWatches() {
+    bool is_restored = false;
+
+    for (auto it = _lost_directories.begin(); it != _lost_directories.end();) {
+        const string directory = *it;
+
+        std::error_code ec;
+        if (!std::filesystem::is_directory(directory, ec) || !_WatchDirectory(directory)) {
+            ++it;
+            continue;
+        }
+
+        it = _lost_directories.erase(it);
+        is_restored = true;
+
+        WEBDASH_LOG(WebDash::LogType::INFO, "Config watcher: watching " + directory + " again.");
+
+        // Recreated without us seeing it.
+        for (const auto& [path, configs] : _configs) {
+            if (std::filesystem::path(path).parent_path().string() == directory)
+                _changed.insert(path);
+        }
+        if (std::filesystem::path(_definitions_path).parent_path().string() == directory)
+            _changed.insert(_definitions_path);
+    }
+
+    return is_restored;
+}
+
+void WebDashConfigWatcher::_Loop() {
+    alignas(inotify_event) char buffer[4096];
+
+    pollfd fds[2] = { { _inotify_fd, POLLIN, 0 }, { _stop_fd, POLLIN, 0 } };
+    bool has_pending = false;
+    bool has_lost = false;
+
+    while (true) {
+        // With changes pending, wait for the events to settle before reporting them.
+        const int ready = poll(fds, 2, has_pending ? kSettleMs : has_lost ? kRestoreIntervalMs : -1);
+        if (ready < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("WebDashConfigWatcher!poll");
+            return;
+        }
+
+        if (fds[1].revents & POLLIN)
+            return;
+
+        if (ready == 0) {
+            if (has_pending) {
+                has_pending = false;
+                if (_on_change)
+                    _on_change();
+            }
+
+            if (has_lost) {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (_RestoreWatches())
+                    has_pending = true;
+                has_lost = !_lost_directories.empty();
+            }
+            continue;
+        }
+
+        const ssize_t len = read(_inotify_fd, buffer, sizeof(buffer));
+        if (len <= 0)
+            continue;
+
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for (ssize_t offset = 0; offset < len;) {
+            const inotify_event* event = (const inotify_event*)(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+
+            // Events were lost: anything may have changed.
+            if (event->mask & IN_Q_OVERFLOW) {
+                _changed.insert(_definitions_path);
+                has_pending = true;
+                continue;
+            }
+
+            auto it = _directories.find(event->wd);
+            if (it == _directories.end())
+                continue;
+
+            // The directory was removed (or its file system unmounted).
+            if (event->mask & IN_IGNORED) {
+                MyWorld().Log(WebDash::LogType::WARN, "Config watcher: " + it->second + " went away. Watching it again once it exists.");
+                _lost_directories.insert(it->second);
+                _directories.erase(it);
+                has_lost = true;
+                continue;
+            }
+
+            if (event->len == 0)
+                continue;
+
+            const string path = it->second + "/" + event->name;
+            if (path == _definitions_path || _configs.count(path)) {
+                WEBDASH_LOG(WebDash::LogType::DEBUG, "Config watcher: " + path + " changed.");
+                _changed.insert(path);
+                has_pending = true;
+            }
+        }
+    }
+}
@@ -1,17 +1,38 @@
 #include "webdash-utils.hpp"
 #include "webdash-config.hpp"
+#include "webdash-config-image.hpp"
+#include "webdash-config-registry.hpp"
+#include "webdash-fingerprint.hpp"
 #include "webdash-types.hpp"
 #include "webdash-core.hpp"
+#include "webdash-executor.hpp"
+#include "webdash-scheduler.hpp"
 
+#include <algorithm>
 #include <iostream>
 #include <fstream>
+#include <mutex>
 #include <optional>
+#include <unordered_set>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <nlohmann/json.hpp>
 using namespace std;
 
+namespace {
+    // "WDCI"
+    constexpr uint32_t kImageMagic = 0x49434457;
 
-WebDashConfig::WebDashConfig(string path) {
+    int64_t GetMtimeNs(const struct stat& st) {
+        return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    }
+}
+
+WebDashConfig::WebDashConfig(string path, bool is_lazy) {
     _path = path;
+    _is_lazy = is_lazy;
 
     _is_loaded = false;
 
@@ -22,50 +43,230 @@ WebDashConfig::WebDashConfig(string path) {
 
 bool WebDashConfig::Load() {
     tasks.clear();
-    
+    _task_index.clear();
+
+    // Taken before reading, so that a change while loading makes the image stale.
+    struct stat st;
+    if (stat(_path.c_str(), &st) == 0) {
+        _source_size = st.st_size;
+        _source_mtime = GetMtimeNs(st);
+    }
+
+    _environment = webdash::Environment::Build(MyWorld().GetEnvAdditions());
+    _SetDefinitions(GetAllDefinitions());
+
+    if (_LoadImage())
+        return true;
+
+    if (!_Parse())
+        return false;
+
+    _IndexCommands();
+    WEBDASH_LOG(WebDash::LogType::DEBUG, "Commands loaded. Available count: " + to_string(tasks.size()));
+
+    if (!_is_lazy) {
+        for (size_t i = 0; i < tasks.size(); ++i)
+            _Materialize(i);
+    }
+
+    return true;
+}
+
+void WebDashConfig::_IndexCommands() {
+    tasks.clear();
+
+    const json& cmds = _config["commands"];
+    for (size_t i = 0; i < cmds.size(); ++i) {
+        const json& cmd = cmds[i];
+        if (!cmd.is_object() || !cmd.contains("name") || !cmd["name"].is_string()) {
+            WEBDASH_LOG(WebDash::LogType::DEBUG, "Failed getting name from " + to_string(i) + "th command.");
+            continue;
+        }
+
+        TaskEntry entry;
+        entry.position = i;
+        entry.raw_name = cmd["name"].get<std::string>();
+        tasks.push_back(std::move(entry));
+    }
+
+    _RebuildTaskIndex();
+}
+
+void WebDashConfig::_RebuildTaskIndex() {
+    _task_index.clear();
+
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        TaskEntry& entry = tasks[i];
+        entry.name = entry.task.has_value() ? entry.task->GetName() : _substitutions.Apply(entry.raw_name);
+        _task_index.emplace(entry.name, i);
+    }
+}
+
+WebDashConfigTask* WebDashConfig::_Materialize(size_t index) {
+    std::lock_guard<std::mutex> lock(_materialize_mutex);
+
+    TaskEntry& entry = tasks[index];
+    if (!entry.task.has_value()) {
+        const json& cmd = _config.at("commands").at(entry.position);
+        WEBDASH_LOG(WebDash::LogType::DEBUG, to_string(entry.position) + "th command: " + cmd.dump());
+        entry.task.emplace(this, _path + "#" + entry.raw_name, cmd);
+    }
+
+    return &entry.task.value();
+}
+
+bool WebDashConfig::_Parse() {
     ifstream configStream;
     try {
-        MyWorld().Log(WebDash::LogType::DEBUG, "Opening webdash config file: " + _path);
+        WEBDASH_LOG(WebDash::LogType::DEBUG, "Opening webdash config file: " + _path);
         configStream.open(_path.c_str(), ifstream::in);
     } catch (...) {
         MyWorld().Log(WebDash::LogType::ERR, "Issues opening to config file. Something wrong with path?");
         return false;
     }
     
+    json config;
     try {
-        configStream >> _config;
+        configStream >> config;
     } catch (...) {
         MyWorld().Log(WebDash::LogType::ERR, "Was unable to parse the config '" + _path + "' file. Format error?");
         return false;
     }
 
-    json cmds;
-    try {
-        cmds = _config["commands"];
-    } catch (...) {
+    if (!config.contains("commands")) {
         MyWorld().Log(WebDash::LogType::ERR, "No 'commands' given.");
         return false;
     }
 
-    MyWorld().Log(WebDash::LogType::DEBUG, "Commands loaded. Available count: " + to_string(cmds.size()));
-    
-    int cmd_dx = 0;
-    for (auto cmd : cmds) {
-        MyWorld().Log(WebDash::LogType::DEBUG, to_string(cmd_dx) + "th command: " + cmd.dump());
-        
-        try {
-            const string cmdid = _path + "#" + cmd["name"].get<std::string>();
-            tasks.emplace_back(this, cmdid, cmd);
-        } catch (...) {
-            MyWorld().Log(WebDash::LogType::DEBUG, "Failed getting name from " + to_string(cmd_dx) + "th command.");
+    _config = std::move(config);
+    return true;
+}
+
+bool WebDashConfig::_LoadImage() {
+    const string image_path = GetImagePath();
+
+    const int fd = open(image_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    const size_t size = st.st_size;
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    bool is_loaded = false;
+    try {
+        webdash::ImageReader reader((const char*)data, size);
+
+        if (reader.GetU32() != kImageMagic || reader.GetU32() != webdash::kConfigImageVersion)
+            throw std::invalid_argument("version");
+
+        if (reader.GetU64() != _source_size || (int64_t)reader.GetU64() != _source_mtime)
+            throw std::invalid_argument("config changed");
+
+        if (reader.GetU64() != _GetDefinitionsHash())
+            throw std::invalid_argument("definitions changed");
+
+        const uint64_t body_hash = reader.GetU64();
+        if (webdash::Fnv1a(reader.GetRemaining(), reader.GetRemainingSize(), webdash::kFnv1aOffsetBasis) != body_hash)
+            throw std::invalid_argument("corrupt");
+
+        const uint64_t count = reader.GetU64();
+        vector<WebDashConfigTask> loaded;
+        for (uint64_t i = 0; i < count; ++i)
+            loaded.emplace_back(this, reader);
+
+        if (reader.GetRemainingSize() != 0)
+            throw std::invalid_argument("trailing data");
+
+        tasks.clear();
+        tasks.resize(loaded.size());
+        for (size_t i = 0; i < loaded.size(); ++i)
+            tasks[i].task.emplace(std::move(loaded[i]));
+        _RebuildTaskIndex();
+
+        is_loaded = true;
+    } catch (const std::exception& e) {
+        WEBDASH_LOG(WebDash::LogType::DEBUG, "Not using " + image_path + ": " + e.what());
+    }
+
+    munmap(data, size);
+
+    if (is_loaded)
+        WEBDASH_LOG(WebDash::LogType::DEBUG, "Loaded precompiled config " + image_path + ". Available count: " + to_string(tasks.size()));
+
+    return is_loaded;
+}
+
+bool WebDashConfig::Compile() {
+    if (!_is_loaded)
+        return false;
+
+    webdash::ImageWriter body;
+    body.PutU64(tasks.size());
+    for (WebDashConfigTask* task : GetTasks())
+        task->WriteImage(body);
+
+    webdash::ImageWriter image;
+    image.PutU32(kImageMagic);
+    image.PutU32(webdash::kConfigImageVersion);
+    image.PutU64(_source_size);
+    image.PutU64(_source_mtime);
+    image.PutU64(_GetDefinitionsHash());
+    image.PutU64(webdash::Fnv1a(body.GetData().data(), body.GetData().size(), webdash::kFnv1aOffsetBasis));
+
+    // Written aside and renamed into place, so that readers never map a partial image.
+    const string image_path = GetImagePath();
+    const string staging = image_path + ".tmp-" + to_string(getpid());
+    {
+        ofstream out(staging, ios::binary | ios::trunc);
+        out << image.GetData() << body.GetData();
+        out.close();
+
+        if (!out) {
+            MyWorld().Log(WebDash::LogType::ERR, "Unable to write " + staging);
+            unlink(staging.c_str());
+            return false;
         }
+    }
 
-        cmd_dx++;
+    if (rename(staging.c_str(), image_path.c_str()) != 0) {
+        perror("WebDashConfig::Compile!rename");
+        unlink(staging.c_str());
+        return false;
     }
 
+    WEBDASH_LOG(WebDash::LogType::INFO, "Compiled " + _path + " (" + to_string(tasks.size()) + " tasks) to " + image_path);
     return true;
 }
 
+uint64_t WebDashConfig::_GetDefinitionsHash() const {
+    uint64_t hash = webdash::kFnv1aOffsetBasis;
+
+    for (const auto& [name, value] : _definitions) {
+        hash = webdash::Fnv1a(name, hash);
+        hash = webdash::Fnv1a(string(1, '\0'), hash);
+        hash = webdash::Fnv1a(value, hash);
+        hash = webdash::Fnv1a(string(1, '\0'), hash);
+    }
+
+    for (const auto& [name, value] : _environment->GetAdditions()) {
+        hash = webdash::Fnv1a(name, hash);
+        hash = webdash::Fnv1a(string(1, '\0'), hash);
+        hash = webdash::Fnv1a(value, hash);
+        hash = webdash::Fnv1a(string(1, '\0'), hash);
+    }
+
+    return hash;
+}
+
 string WebDashConfig::GetPath() const {
     return _path;
 }
@@ -85,11 +286,109 @@ vector<pair<string, string>> WebDashConfig::GetAllDefinitions() const {
 }
 
 void WebDashConfig::Reload() {
-    _is_loaded = false;
-    
-    if (Load()) {
-        _is_loaded = true;
+    if (!_is_loaded) {
+        if (Load())
+            _is_loaded = true;
+        return;
+    }
+
+    struct stat st;
+    const bool has_file_changed = stat(_path.c_str(), &st) != 0 || (uint64_t)st.st_size != _source_size ||
+                                  GetMtimeNs(st) != _source_mtime;
+
+    // Keys whose value changed, appeared or disappeared.
+    const auto definitions = GetAllDefinitions();
+    unordered_set<string> changed_keys;
+    {
+        unordered_map<string, string> previous(_definitions.begin(), _definitions.end());
+        for (const auto& [name, value] : definitions) {
+            auto it = previous.find(name);
+            if (it == previous.end() || it->second != value)
+                changed_keys.insert(name);
+            if (it != previous.end())
+                previous.erase(it);
+        }
+        for (const auto& [name, value] : previous)
+            changed_keys.insert(name);
+    }
+
+    // Tasks not built yet have nothing to keep.
+    const auto is_affected = [&changed_keys](const TaskEntry& entry) {
+        if (!entry.task.has_value())
+            return false;
+
+        for (const string& key : entry.task->GetReferencedDefinitions())
+            if (changed_keys.count(key))
+                return true;
+        return false;
+    };
+
+    const auto additions = MyWorld().GetEnvAdditions();
+    if (additions != _environment->GetAdditions()) {
+        _environment = webdash::Environment::Build(additions);
+        for (TaskEntry& entry : tasks)
+            if (entry.task.has_value())
+                entry.task->SetEnvironment(_environment);
+    }
+
+    if (!has_file_changed && std::none_of(tasks.begin(), tasks.end(), is_affected)) {
+        _SetDefinitions(definitions);
+
+        // Names of tasks not built yet may use definitions too.
+        _RebuildTaskIndex();
+        WEBDASH_LOG(WebDash::LogType::DEBUG, "Reload: no task of " + _path + " affected.");
+        return;
+    }
+
+    // Keep the running version of the config rather than none at all.
+    if (!_Parse()) {
+        MyWorld().Log(WebDash::LogType::ERR, "Reload: keeping the tasks of " + _path + " as they were.");
+        return;
     }
+
+    if (has_file_changed) {
+        _source_size = st.st_size;
+        _source_mtime = GetMtimeNs(st);
+    }
+    _SetDefinitions(definitions);
+
+    vector<TaskEntry> previous = std::move(tasks);
+    const unordered_map<string, size_t> previous_index = std::move(_task_index);
+    _IndexCommands();
+
+    size_t kept = 0;
+    vector<bool> is_taken(previous.size(), false);
+    for (TaskEntry& entry : tasks) {
+        auto it = previous_index.find(entry.name);
+        if (it == previous_index.end() || is_taken[it->second])
+            continue;
+
+        TaskEntry& old = previous[it->second];
+        if (!old.task.has_value() || is_affected(old))
+            continue;
+
+        const json& cmd = _config["commands"][entry.position];
+        if (old.task->GetSourceHash() != webdash::Fnv1a(cmd.dump(), webdash::kFnv1aOffsetBasis))
+            continue;
+
+        is_taken[it->second] = true;
+        entry.task.emplace(std::move(old.task.value()));
+        kept++;
+    }
+
+    if (!_is_lazy) {
+        for (size_t i = 0; i < tasks.size(); ++i)
+            _Materialize(i);
+    }
+
+    WEBDASH_LOG(WebDash::LogType::INFO, "Reloaded " + _path + ": " + to_string(kept) + " task(s) unchanged, " +
+                                        to_string(tasks.size() - kept) + " new or changed, " +
+                                        to_string(previous.size() - kept) + " replaced or removed.");
+}
+
+void WebDashConfig::_SetDefinitions(vector<pair<string, string>> definitions) {
+    _substitutions = webdash::Substitutions(definitions);
+    _definitions = std::move(definitions);
 }
 
 void WebDashConfig::Serialize(WriterType writer) {
@@ -97,66 +396,114 @@ void WebDashConfig::Serialize(WriterType writer) {
     writer(WebDash::StoreWriteType::Append, _path);
 }
 
-vector<string> WebDashConfig::GetTaskList() {
+vector<string> WebDashConfig::GetTaskList() const {
     vector<string> ret;
+    ret.reserve(tasks.size());
 
-    for (auto task : tasks) {
-        ret.push_back(task.GetName());
+    for (const auto& entry : tasks) {
+        ret.push_back(entry.name);
     }
 
     return ret;
 }
 
-std::optional<WebDashConfigTask> WebDashConfig::GetTask(const string cmdname) {
-    for (auto task : tasks)
-        if (task.GetName() == cmdname)
-            return task;
+WebDashConfigTask* WebDashConfig::GetTask(const string& cmdname) {
+    auto it = _task_index.find(cmdname);
+    if (it == _task_index.end())
+        return nullptr;
 
-    return nullopt;
+    return _Materialize(it->second);
 }
 
-std::vector<webdash::RunReturn> WebDashConfig::Run(const string cmdName, webdash::RunConfig runconfig) {
-    std::vector<webdash::RunReturn> ret;
+vector<WebDashConfigTask*> WebDashConfig::GetTasks() {
+    vector<WebDashConfigTask*> ret;
+    ret.reserve(tasks.size());
+
+    for (size_t i = 0; i < tasks.size(); ++i)
+        ret.push_back(_Materialize(i));
+
+    return ret;
+}
 
+std::function<WebDashConfigTask*(string)> WebDashConfig::_MakeTaskRetriever() {
     // Enables tasks to resolve task-wide tasks.
     // Meaning, one can specify ":<task_name>" as an action.
     //                          "$.thisDir()/path-relative-to-dir-of-current-config/webdash.config.json:blabla"
     //                          "./path-relative-to-myworld/x/y/z/webdash.config.json:blabla"
-    runconfig.TaskRetriever = [&](const string cmdid) -> optional<WebDashConfigTask> {
+
+    // The configs tasks were taken from. A config replaced in the registry lives on while its tasks are in use.
+    struct UsedConfigs {
+        std::mutex mutex;
+        unordered_set<std::shared_ptr<WebDashConfig>> configs;
+    };
+    auto used_configs = std::make_shared<UsedConfigs>();
+
+    return [this, used_configs](const string cmdid) -> WebDashConfigTask* {
         cout << "Resolving dependency: " << cmdid << endl;
 
         if (cmdid[0] == ':') {
             return GetTask(cmdid.substr(1));
         } else {
             if (cmdid.find(":") == string::npos)
-                return nullopt;
+                return nullptr;
 
             const std::string configpath = cmdid.substr(0, cmdid.find(":"));
             const std::string real_cmd_name = cmdid.substr(configpath.length() + 1);
 
             std::filesystem::path path(configpath);
             cout << path << " " << path.is_absolute() << endl;
-            WebDashConfig other(((path.is_absolute() == false) ? WebDashCore::Get().GetMyWorldRootDirectory() + "/" : "") + configpath);
+            const string fullpath = ((path.is_absolute() == false) ? WebDashCore::Get().GetMyWorldRootDirectory() + "/" : "") + configpath;
 
-            if (!other.IsLoaded())
-                return nullopt;
+            std::shared_ptr<WebDashConfig> other = WebDashConfigRegistry::Get().Find(fullpath);
+            if (!other)
+                return nullptr;
 
-            return other.GetTask(real_cmd_name);
+            // The executor may resolve from several threads.
+            {
+                std::lock_guard<std::mutex> lock(used_configs->mutex);
+                used_configs->configs.insert(other);
+            }
+
+            return other->GetTask(real_cmd_name);
         }
 
-        return nullopt;
+        return nullptr;
     };
+}
+
+std::vector<webdash::RunReturn> WebDashConfig::Run(const string cmdName, webdash::RunConfig runconfig) {
+    std::vector<webdash::RunReturn> ret;
+
+    runconfig.TaskRetriever = _MakeTaskRetriever();
 
-    for (WebDashConfigTask& task : tasks) {
-        if (task.IsValid() == false)
+    // Only the selected tasks (and later their dependencies) are built.
+    vector<WebDashConfigTask*> selected;
+    for (size_t i = 0; i < tasks.size(); ++i) {
+        if (cmdName != "" && tasks[i].name != cmdName)
             continue;
-            
-        if (task.GetName() == cmdName) {
-            ret.push_back(task.Run(runconfig));
-        } else if (cmdName == "") {
-            ret.push_back(task.Run(runconfig));
-        }
+
+        WebDashConfigTask* task = _Materialize(i);
+        if (task->IsValid() == false)
+            continue;
+
+        selected.push_back(task);
     }
 
+    // All selected tasks share one executor, so independent tasks run concurrently too.
+    auto executor = std::make_shared<WebDashExecutor>(runconfig);
+    ret = executor->Run(selected);
+
     return ret;
+}
+
+std::unique_ptr<WebDashScheduler> WebDashConfig::CreateScheduler(webdash::RunConfig runconfig) {
+    runconfig.TaskRetriever = _MakeTaskRetriever();
+
+    vector<WebDashConfigTask*> valid;
+    for (WebDashConfigTask* task : GetTasks()) {
+        if (task->IsValid())
+            valid.push_back(task);
+    }
+
+    return std::make_unique<WebDashScheduler>(valid, runconfig);
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #include "webdash-utils.hpp"
 #include "webdash-core.hpp"
+#include "webdash-substitutions.hpp"
 
 #include <nlohmann/json.hpp>
 #include <queue>
@@ -7,6 +8,7 @@
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <sys/stat.h>
 using namespace std;
 using json = nlohmann::json;
 
@@ -32,18 +34,39 @@ namespace {
         if (key[0] == '.') return true; // Ignore ".string" patterns.
         return false;
     }
+
+    // $WEBDASH_LOG_LEVEL, if it names a level.
+    std::optional<WebDash::LogType> GetLogLevelFromEnvironment() {
+        const char* level = getenv("WEBDASH_LOG_LEVEL");
+        if (level == nullptr)
+            return nullopt;
+
+        for (const auto& [type, name] : WebDash::kTypeToString) {
+            if (name == level)
+                return type;
+        }
+        return nullopt;
+    }
 }
 
 WebDashCore::WebDashCore(PrivateCtorClass private_ctor) {
     /* unused */ (void) private_ctor;
 
+    if (auto level = GetLogLevelFromEnvironment())
+        SetLogLevel(*level);
+
     if (!_CalculateMyWorldRootDirectory()) {
         cout << "Could not find WebDash root directory." << endl;
         return;
     }
+    _logger.Open(GetAndCreateLogDirectory());
     _InitializeLoggingFiles();
 
-    Log(WebDash::LogType::DEBUG, "Determined WebDash root path: " + _myworld_root_path);
+    // MyWorld() is not available yet, hence no WEBDASH_LOG.
+    if constexpr (WebDash::IsLogCompiled(WebDash::LogType::DEBUG)) {
+        if (IsLogEnabled(WebDash::LogType::DEBUG))
+            Log(WebDash::LogType::DEBUG, "Determined WebDash root path: " + _myworld_root_path);
+    }
 }
 
 /* static */ void WebDashCore::Create(std::optional<string> cwd) {
@@ -92,19 +115,46 @@ vector<pair<string, string>> WebDashCore::GetCoreDefinitions() const {
 }
 
 vector<pair<string, string>> WebDashCore::GetCustomDefinitions(bool file_must_exist) {
-    vector<pair<string, string>> ret;
+    auto defs = GetDefinitions();
+
+    // Treat a missing or malformed file as error iff file_must_exist is TRUE.
+    if (!defs->is_valid && file_must_exist)
+        Log(WebDash::LogType::ERR, "Was unable to parse the config '" + _myworld_root_path + "/definitions.json' file. Format error?");
 
+    return defs->custom;
+}
+
+std::shared_ptr<const WebDash::Definitions> WebDashCore::GetDefinitions() {
     const string path = _myworld_root_path + "/definitions.json";
 
-    //
-    // Check if the above definitions.json file exists. Return if not. Treat as error iff file_must_exist is TRUE.
-    //
+    struct stat st;
+    const bool exists = stat(path.c_str(), &st) == 0;
+    const uint64_t inode = exists ? st.st_ino : 0;
+    const int64_t size = exists ? st.st_size : -1;
+    const int64_t mtime = exists ? (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec : 0;
+
+    std::lock_guard<std::mutex> lock(_definitions_mutex);
+
+    if (_definitions && _definitions_path == path && _definitions_inode == inode &&
+        _definitions_size == size && _definitions_mtime == mtime)
+        return _definitions;
+
+    _definitions = std::make_shared<const WebDash::Definitions>(_ParseDefinitions(path));
+    _definitions_path = path;
+    _definitions_inode = inode;
+    _definitions_size = size;
+    _definitions_mtime = mtime;
+
+    return _definitions;
+}
+
+WebDash::Definitions WebDashCore::_ParseDefinitions(const string& path) {
+    WebDash::Definitions ret;
 
     ifstream configStream;
     try {
         configStream.open(path.c_str(), ifstream::in);
     } catch (...) {
-        if (file_must_exist) Log(WebDash::LogType::ERR, "Issues opening the definitions file.");
         return ret;
     }
 
@@ -112,10 +162,11 @@ vector<pair<string, string>> WebDashCore::GetCustomDefinitions(bool file_must_ex
     try {
         configStream >> _defs;
     } catch (...) {
-        if (file_must_exist) Log(WebDash::LogType::ERR, "Was unable to parse the config '" + path + "' file. Format error?");
         return ret;
     }
 
+    ret.is_valid = true;
+
     //
     // Parse the whole /definitions.json file with a BFS.
     //
@@ -123,7 +174,7 @@ vector<pair<string, string>> WebDashCore::GetCustomDefinitions(bool file_must_ex
     queue<pair<string, json>> Q;
     Q.push(make_pair("", _defs));
 
-    auto core_subs = GetCoreDefinitions();
+    const webdash::Substitutions core_subs(GetCoreDefinitions());
 
     while (!Q.empty()) {
         pair<string, json> u = Q.front();
@@ -136,8 +187,8 @@ vector<pair<string, string>> WebDashCore::GetCustomDefinitions(bool file_must_ex
                 if (elem.is_object() || elem.is_array()) {
                     Q.push(make_pair(nkey, elem));
                 } else {
-                    ret.push_back(make_pair("$#" + nkey,
-                        ApplySubstitutions(BasicJsonToString(elem), core_subs)
+                    ret.custom.push_back(make_pair("$#" + nkey,
+                        core_subs.Apply(BasicJsonToString(elem))
                     ));
                 }
                 dx++;
@@ -152,14 +203,26 @@ vector<pair<string, string>> WebDashCore::GetCustomDefinitions(bool file_must_ex
             if (value.is_object() || value.is_array()) {
                 Q.push(make_pair(u.first + "." + key, value));
             } else {
-                ret.push_back(make_pair(
+                ret.custom.push_back(make_pair(
                     "$#" + u.first + "." + key,
-                    ApplySubstitutions(BasicJsonToString(value), core_subs)
+                    core_subs.Apply(BasicJsonToString(value))
                 ));
             }
         }
     }
 
+    ParseJsonConcats(ret.custom, [&](vector<string> tokens, string val) {
+        if (tokens.size() >= 3 && tokens[1] == "env") {
+            string key = "";
+            for (size_t i = 2; i < tokens.size(); ++i) {
+                key += tokens[i];
+                if (i + 1 < tokens.size())
+                    key += ".";
+            }
+            ret.env.push_back(make_pair(key, core_subs.Apply(val)));
+        }
+    });
+
     return ret;
 }
 
@@ -214,10 +277,11 @@ bool WebDashCore::_CalculateMyWorldRootDirectory() {
 }
 
 void WebDashCore::_InitializeLoggingFiles() {
-    Log(WebDash::LogType::ERR, "");
-    Log(WebDash::LogType::INFO, "");
-    Log(WebDash::LogType::WARN, "");
-    Log(WebDash::LogType::DEBUG, "");
+    // Also the files of disabled types, so they don't keep the output of an earlier run.
+    _logger.Log(WebDash::LogType::ERR, "", LogCode::E_UNKNOWN, false);
+    _logger.Log(WebDash::LogType::INFO, "", LogCode::E_UNKNOWN, false);
+    _logger.Log(WebDash::LogType::WARN, "", LogCode::E_UNKNOWN, false);
+    _logger.Log(WebDash::LogType::DEBUG, "", LogCode::E_UNKNOWN, false);
 }
 
 string WebDashCore::GetMyWorldRootDirectory() {
@@ -228,7 +292,7 @@ std::filesystem::path WebDashCore::GetPersistenteStoragePath() {
     filesystem::path ret = GetMyWorldRootDirectory();
     ret += string("/app-persistent/data/") + _WEBDASH_PROJECT_NAME_;
 
-    Log(WebDash::LogType::DEBUG, "Create recursive: " + ret.string());
+    WEBDASH_LOG(WebDash::LogType::DEBUG, "Create recursive: " + ret.string());
 
     std::filesystem::create_directories(ret);
     
@@ -290,40 +354,19 @@ void WebDashCore::LoadFromMyStorage(const string filename, WebDash::StoreReadTyp
         return;
     }
 }
-static string StringifyLogCode(LogCode err) {
-    std::stringstream stream;
-    stream << std::hex << (static_cast<int>(err));
-    std::string result( stream.str() );
-    return result;
-}
+void WebDashCore::Log(WebDash::LogType type, std::string msg, const LogCode errcode, const bool append_if_possible) {
+    if (!IsLogEnabled(type))
+        return;
 
-void WebDashCore::Log(WebDash::LogType type, const std::string msg, const LogCode errcode, const bool append_if_possible) {
-    // Get current time to add timestamp to the log entry.
-    std::string curr_time = "";
-    {
-        auto now_c = std::chrono::system_clock::now();
-        std::time_t now_t = std::chrono::system_clock::to_time_t(now_c);
-        
-        std::stringstream ss;
-        ss << std::put_time(std::localtime(&now_t), "%F %T");
-        curr_time = ss.str();
-    }
+    _logger.Log(type, std::move(msg), errcode, append_if_possible);
+}
 
-    const string fpath = GetAndCreateLogDirectory() + "/logging." + WebDash::kTypeToString.at(type) + ".txt";
-    const bool fexists = std::filesystem::exists(fpath.c_str()); // does the file already exist?
-    
-    // Program was newly started and our goal is not to append
-    // OR file does not exist, then initialize empty file.
-    if ((!_is_logtype_initialized[type] && !append_if_possible) || (!fexists)) {
-        std::ofstream out(fpath.c_str());
-        out << StringifyLogCode(LogCode::N_INIT_LOG_FILE) << " " << curr_time << ": initialized this file." << std::endl;
-        out.close();
-        _is_logtype_initialized[type] = true;
-    }
+void WebDashCore::FlushLog() {
+    _logger.Flush();
+}
 
-    // Write data.
-    std::ofstream out(fpath.c_str(), std::ofstream::out | std::ofstream::app);
-    out << StringifyLogCode(errcode) << " " << curr_time << ": " << msg << std::endl;
+void WebDashCore::SetLogLevel(WebDash::LogType level) {
+    _log_verbosity.store(WebDash::GetLogVerbosity(level), std::memory_order_relaxed);
 }
 
 void WebDashCore::Notify(const std::string msg, const LogCode logcode) {
@@ -355,22 +398,11 @@ vector<string> WebDashCore::GetPathAdditions() {
 }
 
 vector<pair<string, string>> WebDashCore::GetEnvAdditions() {
-    vector<pair<string, string>> ret;
+    auto defs = GetDefinitions();
+    if (!defs->is_valid)
+        Log(WebDash::LogType::ERR, "Was unable to parse the config '" + _myworld_root_path + "/definitions.json' file. Format error?");
 
-    auto defs = GetCustomDefinitions(true);
-    ParseJsonConcats(defs, [&](vector<string> tokens, string val) {
-        if (tokens.size() >= 3 && tokens[1] == "env") {
-            string key = "";
-            for (size_t i = 2; i < tokens.size(); ++i) {
-                key += tokens[i];
-                if (i + 1 < tokens.size())
-                    key += ".";
-            }
-            ret.push_back(make_pair(key, ApplySubstitutions(val, GetCoreDefinitions())));
-        }
-    });
-
-    return ret;
+    return defs->env;
 }
 
 vector<WebDash::PullProject> WebDashCore::GetExternalProjects() {
@@ -0,0 +1,625 @@
+#include "webdash-executor.hpp"
+#include "webdash-action-cache.hpp"
+#include "webdash-capture.hpp"
+#include "webdash-core.hpp"
+#include "webdash-worker-pool.hpp"
+
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <thread>
+using namespace std;
+
+
+namespace {
+    // Threads resuming parked nodes of all executors (see WebDashExecutor::_Schedule).
+    class Drivers {
+        public:
+            // Never destroyed: the supervisor thread may complete handles until the very end.
+            static Drivers& Get() {
+                static Drivers* drivers = new Drivers();
+                return *drivers;
+            }
+
+            void Post(std::function<void()> work) {
+                {
+                    std::lock_guard<std::mutex> lock(_mutex);
+
+                    // Started on first use; tasks mostly wait for processes, so few are needed.
+                    if (_threads.empty()) {
+                        const int count = max(2, (int)std::thread::hardware_concurrency());
+                        for (int i = 0; i < count; ++i)
+                            _threads.emplace_back(&Drivers::_Loop, this);
+                    }
+
+                    _work.push_back(std::move(work));
+                }
+
+                _wakeup.notify_one();
+            }
+
+        private:
+            void _Loop() {
+                std::unique_lock<std::mutex> lock(_mutex);
+
+                while (true) {
+                    _wakeup.wait(lock, [this]() { return !_work.empty(); });
+
+                    std::function<void()> work = std::move(_work.front());
+                    _work.pop_front();
+
+                    lock.unlock();
+                    work();
+                    work = nullptr;
+                    lock.lock();
+                }
+            }
+
+            vector<std::thread> _threads;
+
+            deque<std::function<void()>> _work;
+
+            std::mutex _mutex;
+            std::condition_variable _wakeup;
+    };
+}
+
+WebDashExecutor::WebDashExecutor(webdash::RunConfig config) : _config(config) {
+    _jobs = _config.jobs;
+    if (_jobs <= 0 && !_config.workers.empty())
+        _jobs = max(1, WebDashWorkerPool::Get().Connect(_config.workers));
+    if (_jobs <= 0)
+        _jobs = max(1, (int)std::thread::hardware_concurrency());
+}
+
+vector<webdash::TaskHandle> WebDashExecutor::Start(vector<WebDashConfigTask*> tasks) {
+    vector<webdash::TaskHandle> ret;
+    std::weak_ptr<WebDashExecutor> weak_self = shared_from_this();
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        for (WebDashConfigTask* task : tasks) {
+            _nodes.emplace_back();
+            Node* node = &_nodes.back();
+            node->task = task;
+            node->is_queued = true;
+            node->root_handle.emplace();
+            node->root_handle->SetCanceller([weak_self]() {
+                if (auto self = weak_self.lock())
+                    self->Cancel();
+            });
+            _nodes_by_taskid.emplace(task->GetTaskId(), node);
+
+            _ready.push_back(node);
+            ret.push_back(node->root_handle.value());
+        }
+    }
+
+    WEBDASH_LOG(WebDash::LogType::DEBUG, "Executor: running " + to_string(tasks.size()) + " task(s) with " + to_string(_jobs) + " job(s).");
+
+    _Drive();
+
+    return ret;
+}
+
+vector<webdash::RunReturn> WebDashExecutor::Run(vector<WebDashConfigTask*> tasks) {
+    vector<webdash::RunReturn> ret;
+
+    for (const auto& handle : Start(tasks))
+        ret.push_back(handle.Wait());
+
+    return ret;
+}
+
+void WebDashExecutor::Cancel() {
+    vector<webdash::TaskHandle> running;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_Abort(running))
+            return;
+    }
+
+    _Stop(running);
+}
+
+bool WebDashExecutor::_Abort(vector<webdash::TaskHandle>& running) {
+    if (_is_cancelled)
+        return false;
+
+    _is_cancelled = true;
+
+    for (Node& node : _nodes)
+        if (node.running.has_value())
+            running.push_back(node.running.value());
+
+    // Nodes waiting for a job slot finish right away.
+    for (Node* node : _launch_queue)
+        _ready.push_front(node);
+    _launch_queue.clear();
+
+    return true;
+}
+
+void WebDashExecutor::_Stop(const vector<webdash::TaskHandle>& running) {
+    WEBDASH_LOG(WebDash::LogType::INFO, "Executor: cancelled, stopping " + to_string(running.size()) + " process(es).");
+
+    for (const auto& handle : running)
+        handle.Cancel();
+
+    _Schedule();
+}
+
+void WebDashExecutor::_Schedule() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_is_drive_scheduled)
+            return;
+
+        _is_drive_scheduled = true;
+    }
+
+    Drivers::Get().Post([self = shared_from_this()]() { self->_Drive(); });
+}
+
+void WebDashExecutor::_Drive() {
+    while (true) {
+        Node* node = nullptr;
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_ready.empty()) {
+                // Whatever becomes ready from now on needs another driver.
+                _is_drive_scheduled = false;
+                return;
+            }
+
+            node = _ready.front();
+            _ready.pop_front();
+        }
+
+        try {
+            _Process(node);
+        } catch (...) {
+            MyWorld().Log(WebDash::LogType::ERR, "Executor: failed executing " + node->task->GetTaskId());
+            node->result.return_code = -1;
+            _Finish(node);
+        }
+    }
+}
+
+void WebDashExecutor::_Process(Node* node) {
+    bool is_cancelled = false;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        is_cancelled = _is_cancelled;
+    }
+
+    if (!node->is_started) {
+        node->is_started = true;
+
+        if (is_cancelled) {
+            node->result.return_code = -1;
+            _Finish(node);
+            return;
+        }
+
+        const auto in_flight = node->task->Claim(node->run);
+        if (in_flight.has_value()) {
+            _Join(node, in_flight.value());
+            return;
+        }
+
+        if (!node->task->BeginRun(_config)) {
+            _Finish(node);
+            return;
+        }
+
+        if (!_Start(node))
+            return;
+
+        // A failed fail-fast dependency may have cancelled the run meanwhile.
+        std::lock_guard<std::mutex> lock(_mutex);
+        is_cancelled = _is_cancelled;
+    }
+
+    // The other run did the bookkeeping.
+    if (node->is_joined) {
+        _Finish(node);
+        return;
+    }
+
+    while (node->next_step < node->steps.size()) {
+        // All dependencies finished. Their outputs may be our inputs, so only now we know whether to run.
+        if (node->next_step == node->first_action && !node->is_skip_checked) {
+            node->is_skip_checked = true;
+            node->dependency_result = std::move(node->result);
+            node->result = webdash::RunReturn();
+
+            if (!is_cancelled && node->dependency_result.return_code == 0 && _SkipActions(node))
+                break;
+        }
+
+        Step& step = node->steps[node->next_step];
+
+        if (step.is_cyclic) {
+            node->result.return_code |= 1;
+        } else if (step.child != nullptr) {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+
+                // Park this node until the subtask finished. We get re-queued by _Finish.
+                if (!step.child->is_done) {
+                    step.child->waiters.push_back(node);
+                    node->pending = 1;
+                    _Enqueue(step.child);
+                    return;
+                }
+            }
+
+            node->result.Append(step.child->result);
+        } else if (node->result.return_code != 0 && _IsFailFast(node)) {
+            // The remaining actions of a failed fail-fast task never start.
+            break;
+        } else if (is_cancelled) {
+            node->result.return_code = -1;
+            break;
+        } else {
+            // Parks the node; it is re-queued with the next step once the process exited.
+            _Launch(node, *step.pipeline);
+            return;
+        }
+
+        node->next_step++;
+    }
+
+    if (node->cache_key.has_value()) {
+        if (node->result.return_code == 0)
+            WebDashActionCache::Get().Store(node->cache_key.value(), node->result, node->task->GetOutputFiles(), _config.action_cache_size);
+
+        // Output capture was forced for the cache. Nobody asked for it to be captured, so it goes to the terminal.
+        if (!_config.output_sink && !_config.redirect_output_to_str)
+            _Replay(node->task->GetTaskId(), node->result);
+        if (!_config.redirect_output_to_str) {
+            node->result.output.clear();
+            node->result.chunks.clear();
+        }
+    }
+
+    // Dependencies first, as if executed sequentially.
+    if (node->is_skip_checked) {
+        webdash::RunReturn actions_result = std::move(node->result);
+        node->result = std::move(node->dependency_result);
+        node->result.Append(actions_result);
+    }
+
+    if (!node->is_up_to_date)
+        node->task->UpdateFingerprints(node->result);
+
+    node->task->EndRun(node->result);
+
+    _Finish(node);
+}
+
+bool WebDashExecutor::_SkipActions(Node* node) {
+    const string taskid = node->task->GetTaskId();
+
+    // Fingerprints decide whether to skip. The action cache only provides the output of
+    // the last run, as the output files are in place already.
+    if (node->task->HasFingerprints() && node->task->IsUpToDate()) {
+        WEBDASH_LOG(WebDash::LogType::INFO, "Up to date: " + taskid);
+        cout << "UP-TO-DATE: " << taskid << endl;
+        node->is_up_to_date = true;
+
+        const auto cache_key = node->task->GetCacheKey();
+        if (cache_key.has_value()) {
+            auto cached = WebDashActionCache::Get().Restore(cache_key.value(), false);
+            if (cached.has_value())
+                _UseCached(node, std::move(cached.value()));
+        }
+
+        return true;
+    }
+
+    node->cache_key = node->task->GetCacheKey();
+    if (!node->cache_key.has_value())
+        return false;
+
+    auto cached = WebDashActionCache::Get().Restore(node->cache_key.value());
+    if (!cached.has_value())
+        return false;
+
+    WEBDASH_LOG(WebDash::LogType::INFO, "Restored from the action cache: " + taskid);
+    cout << "CACHED: " << taskid << endl;
+
+    _UseCached(node, std::move(cached.value()));
+    node->cache_key.reset();
+    return true;
+}
+
+void WebDashExecutor::_UseCached(Node* node, webdash::RunReturn cached) {
+    if (_config.output_sink || !_config.redirect_output_to_str)
+        _Replay(node->task->GetTaskId(), cached);
+    if (!_config.redirect_output_to_str) {
+        cached.output.clear();
+        cached.chunks.clear();
+    }
+
+    node->result = std::move(cached);
+}
+
+void WebDashExecutor::_Replay(const string& taskid, const webdash::RunReturn& result) {
+    for (const webdash::OutputChunk& chunk : result.chunks) {
+        const char* data = result.output.data() + chunk.offset;
+
+        if (_config.output_sink) {
+            _config.output_sink->Write(taskid, chunk.stream, data, chunk.length);
+        } else {
+            ostream& out = chunk.stream == webdash::Stream::Stderr ? cerr : cout;
+            out.write(data, chunk.length);
+            out.flush();
+        }
+    }
+}
+
+void WebDashExecutor::_Launch(Node* node, const webdash::Pipeline& pipeline) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_running >= _jobs) {
+            _launch_queue.push_back(node);
+            return;
+        }
+
+        _running++;
+    }
+
+    // Results going into the action cache are captured in any case.
+    webdash::RunConfig config = _config;
+    if (node->cache_key.has_value())
+        config.redirect_output_to_str = true;
+
+    webdash::TaskHandle handle = node->task->RunAsync(config, pipeline);
+
+    bool cancel_now = false;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        node->running = handle;
+        cancel_now = _is_cancelled;
+    }
+
+    if (cancel_now)
+        handle.Cancel();
+
+    // Usually called on the supervisor thread, or right away on a failed spawn: only queues the node.
+    auto self = shared_from_this();
+    handle.OnDone([self, node](const webdash::RunReturn& ret) {
+        const bool is_failed = ret.return_code != 0 && self->_IsFailFast(node);
+
+        vector<webdash::TaskHandle> running;
+        bool abort_run = false;
+
+        {
+            std::lock_guard<std::mutex> lock(self->_mutex);
+
+            node->result.Append(ret);
+            node->next_step++;
+            node->running.reset();
+            self->_running--;
+
+            // Before anything is re-queued, so that no driver starts another action of this run.
+            if (is_failed)
+                abort_run = self->_Abort(running);
+
+            self->_ready.push_front(node);
+
+            // Hand the free job slot to the longest waiting node.
+            if (!self->_launch_queue.empty()) {
+                self->_ready.push_front(self->_launch_queue.front());
+                self->_launch_queue.pop_front();
+            }
+        }
+
+        if (abort_run) {
+            MyWorld().Log(WebDash::LogType::ERR, "Executor: " + node->task->GetTaskId() + " failed, aborting the run (fail-fast).");
+            self->_Stop(running);
+        } else {
+            self->_Schedule();
+        }
+    });
+}
+
+bool WebDashExecutor::_Start(Node* node) {
+    auto retrieve = [&](const string& cmdid) -> WebDashConfigTask* {
+        if (!_config.TaskRetriever)
+            return nullptr;
+        return _config.TaskRetriever(cmdid);
+    };
+
+    // Resolve outside of the lock, the retriever may load other configs.
+    vector<WebDashConfigTask*> dependencies;
+    for (const string& dependency : node->task->GetDependencies())
+        dependencies.push_back(retrieve(dependency));
+
+    // Pipelines are always executed, never resolved to tasks.
+    vector<WebDashConfigTask*> subtasks;
+    for (size_t i = 0; i < node->task->GetActions().size(); ++i)
+        subtasks.push_back(node->task->GetCommands()[i].stages.size() > 1 ? nullptr : retrieve(node->task->GetActions()[i]));
+
+    // A failed dependency that finished already, see _Finish.
+    bool abort_run = false;
+
+    bool is_ready = false;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        const auto& dependency_names = node->task->GetDependencies();
+        for (size_t i = 0; i < dependencies.size(); ++i) {
+            // Unresolvable dependencies are ignored.
+            if (dependencies[i] == nullptr)
+                continue;
+
+            Step step;
+            step.action = dependency_names[i];
+            step.child = _GetOrCreateChild(node, dependencies[i], step.is_cyclic);
+            node->steps.push_back(step);
+        }
+
+        const size_t dependency_count = node->steps.size();
+        node->first_action = dependency_count;
+
+        const auto& actions = node->task->GetActions();
+        for (size_t i = 0; i < actions.size(); ++i) {
+            Step step;
+            step.action = actions[i];
+            step.pipeline = &node->task->GetCommands()[i];
+            if (subtasks[i] != nullptr)
+                step.child = _GetOrCreateChild(node, subtasks[i], step.is_cyclic);
+            node->steps.push_back(step);
+        }
+
+        // All dependencies may run concurrently. Queue them in reverse so that
+        // with a single job they execute in declaration order.
+        for (size_t i = dependency_count; i-- > 0;) {
+            Node* child = node->steps[i].child;
+            if (child == nullptr)
+                continue;
+
+            // Shared with a node that finished already (e.g. it was up to date): nothing to wait for.
+            if (child->is_done) {
+                if (child->result.return_code != 0 && _IsFailFast(node))
+                    abort_run = true;
+                continue;
+            }
+
+            child->waiters.push_back(node);
+            node->pending++;
+            _Enqueue(child);
+        }
+
+        // Once the lock is released, finishing dependencies re-queue the node.
+        is_ready = node->pending == 0;
+    }
+
+    if (abort_run) {
+        MyWorld().Log(WebDash::LogType::ERR, "Executor: a dependency of " + node->task->GetTaskId() + " failed, aborting the run (fail-fast).");
+        Cancel();
+    }
+
+    return is_ready;
+}
+
+void WebDashExecutor::_Join(Node* node, const webdash::TaskHandle& in_flight) {
+    WEBDASH_LOG(WebDash::LogType::DEBUG, "Executor: " + node->task->GetTaskId() + " is running already, waiting for it.");
+
+    node->is_joined = true;
+
+    auto self = shared_from_this();
+    in_flight.OnDone([self, node](const webdash::RunReturn& ret) {
+        {
+            std::lock_guard<std::mutex> lock(self->_mutex);
+            node->result = ret;
+            self->_ready.push_front(node);
+        }
+
+        self->_Schedule();
+    });
+}
+
+WebDashExecutor::Node* WebDashExecutor::_GetOrCreateChild(Node* parent, WebDashConfigTask* task, bool& is_cyclic) {
+    is_cyclic = false;
+
+    auto it = _nodes_by_taskid.find(task->GetTaskId());
+    if (it != _nodes_by_taskid.end()) {
+        Node* existing = it->second;
+
+        if (existing == parent || _Reaches(existing, parent)) {
+            MyWorld().Log(WebDash::LogType::ERR, "Executor: dependency cycle on " + task->GetTaskId() + ". Skipped.");
+            is_cyclic = true;
+            return nullptr;
+        }
+
+        WEBDASH_LOG(WebDash::LogType::DEBUG, "Executor: reusing " + task->GetTaskId());
+        return existing;
+    }
+
+    _nodes.emplace_back();
+    Node* node = &_nodes.back();
+    node->task = task;
+    _nodes_by_taskid.emplace(node->task->GetTaskId(), node);
+
+    return node;
+}
+
+bool WebDashExecutor::_Reaches(Node* from, Node* target) const {
+    vector<Node*> stack = { from };
+    std::unordered_map<Node*, bool> visited;
+
+    while (!stack.empty()) {
+        Node* u = stack.back();
+        stack.pop_back();
+
+        if (u == target)
+            return true;
+
+        if (visited[u])
+            continue;
+        visited[u] = true;
+
+        for (const Step& step : u->steps) {
+            if (step.child != nullptr)
+                stack.push_back(step.child);
+        }
+    }
+
+    return false;
+}
+
+void WebDashExecutor::_Enqueue(Node* node) {
+    if (node->is_queued)
+        return;
+
+    node->is_queued = true;
+    _ready.push_front(node);
+}
+
+bool WebDashExecutor::_IsFailFast(Node* node) const {
+    return _config.fail_fast || node->task->IsFailFast();
+}
+
+void WebDashExecutor::_Finish(Node* node) {
+    std::optional<webdash::TaskHandle> root_handle;
+    vector<webdash::TaskHandle> running;
+    bool abort_run = false;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        node->is_done = true;
+
+        // A failed dependency makes the work of fail-fast dependents pointless.
+        bool is_failed = false;
+        for (Node* waiter : node->waiters)
+            is_failed |= node->result.return_code != 0 && _IsFailFast(waiter);
+        if (is_failed)
+            abort_run = _Abort(running);
+
+        for (Node* waiter : node->waiters) {
+            if (--waiter->pending == 0)
+                _ready.push_front(waiter);
+        }
+
+        root_handle = node->root_handle;
+    }
+
+    if (abort_run) {
+        MyWorld().Log(WebDash::LogType::ERR, "Executor: " + node->task->GetTaskId() + " failed, aborting the run (fail-fast).");
+        _Stop(running);
+    }
+
+    // The result is immutable once the node is done.
+    node->run.Complete(node->result);
+    if (root_handle.has_value())
+        root_handle->Complete(node->result);
+}
@@ -0,0 +1,305 @@
+#include "webdash-fingerprint.hpp"
+#include "webdash-core.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <glob.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+
+namespace {
+    const string kManifestFile = "fingerprints.json";
+
+    // Serializes read-merge-write cycles of concurrent invocations.
+    const string kLockFile = "fingerprints.lock";
+
+    constexpr size_t kHashBufferSize = 1 << 16;
+
+    int64_t GetMtimeNs(const struct stat& st) {
+        return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    }
+
+    bool WriteAll(int fd, const string& data) {
+        size_t written = 0;
+        while (written < data.size()) {
+            const ssize_t count = write(fd, data.data() + written, data.size() - written);
+            if (count < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            written += count;
+        }
+        return true;
+    }
+}
+
+uint64_t webdash::Fnv1a(const void* data, size_t len, uint64_t seed) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+    uint64_t hash = seed;
+    for (size_t i = 0; i < len; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+std::optional<uint64_t> webdash::HashFile(const string& path) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return nullopt;
+
+    thread_local vector<char> buffer(kHashBufferSize);
+
+    uint64_t hash = kFnv1aOffsetBasis;
+    while (true) {
+        const ssize_t count = read(fd, buffer.data(), buffer.size());
+        if (count == 0)
+            break;
+
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+
+            close(fd);
+            return nullopt;
+        }
+
+        hash = Fnv1a(buffer.data(), count, hash);
+    }
+
+    close(fd);
+    return hash;
+}
+
+string webdash::ToHex(uint64_t value) {
+    char buffer[17];
+    snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)value);
+    return buffer;
+}
+
+vector<string> webdash::ExpandGlobs(const vector<string>& patterns, const string& base) {
+    vector<string> ret;
+
+    for (const string& pattern : patterns) {
+        const string full_pattern = (pattern.empty() || pattern[0] == '/') ? pattern : base + "/" + pattern;
+
+        int flags = GLOB_TILDE;
+#ifdef GLOB_BRACE
+        flags |= GLOB_BRACE;
+#endif
+
+        glob_t matches;
+        if (glob(full_pattern.c_str(), flags, nullptr, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; ++i) {
+                const string match = matches.gl_pathv[i];
+
+                std::error_code ec;
+                if (!std::filesystem::is_directory(match, ec)) {
+                    ret.push_back(match);
+                    continue;
+                }
+
+                for (auto it = std::filesystem::recursive_directory_iterator(match, ec); !ec && it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+                    if (it->is_regular_file(ec))
+                        ret.push_back(it->path().string());
+                }
+            }
+        }
+
+        globfree(&matches);
+    }
+
+    sort(ret.begin(), ret.end());
+    ret.erase(unique(ret.begin(), ret.end()), ret.end());
+
+    return ret;
+}
+
+/* static */ WebDashFingerprintStore& WebDashFingerprintStore::Get() {
+    static WebDashFingerprintStore store;
+    return store;
+}
+
+bool WebDashFingerprintStore::IsUpToDate(const string& taskid, uint64_t definition, const vector<string>& inputs, const vector<string>& outputs) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _Load();
+
+    auto entry = _manifest.find(taskid);
+    if (entry == _manifest.end() || !entry->is_object())
+        return false;
+
+    if (entry->value("definition", "") != webdash::ToHex(definition))
+        return false;
+
+    bool is_refreshed = false;
+
+    auto files_match = [&](const char* kind, const vector<string>& paths) {
+        auto stored = entry->find(kind);
+        if (stored == entry->end() || !stored->is_object() || stored->size() != paths.size())
+            return false;
+
+        for (const string& path : paths) {
+            auto fingerprint = stored->find(path);
+            if (fingerprint == stored->end() || !_Matches(*fingerprint, path, is_refreshed))
+                return false;
+        }
+
+        return true;
+    };
+
+    const bool ret = files_match("inputs", inputs) && files_match("outputs", outputs);
+
+    if (is_refreshed)
+        _Save(taskid);
+
+    return ret;
+}
+
+void WebDashFingerprintStore::Record(const string& taskid, uint64_t definition, const vector<string>& inputs, const vector<string>& outputs) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _Load();
+
+    const json* previous = _manifest.contains(taskid) ? &_manifest[taskid] : nullptr;
+    const json* previous_inputs = previous != nullptr && previous->contains("inputs") ? &(*previous)["inputs"] : nullptr;
+    const json* previous_outputs = previous != nullptr && previous->contains("outputs") ? &(*previous)["outputs"] : nullptr;
+
+    json entry = json::object();
+    entry["definition"] = webdash::ToHex(definition);
+    entry["inputs"] = _Fingerprint(inputs, previous_inputs);
+    entry["outputs"] = _Fingerprint(outputs, previous_outputs);
+
+    _manifest[taskid] = std::move(entry);
+    _Save(taskid);
+}
+
+void WebDashFingerprintStore::Invalidate(const string& taskid) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _Load();
+
+    if (_manifest.erase(taskid) > 0)
+        _Save(taskid);
+}
+
+void WebDashFingerprintStore::_Load() {
+    if (_is_loaded)
+        return;
+
+    _is_loaded = true;
+
+    MyWorld().LoadFromMyStorage(kManifestFile, WebDash::StoreReadType::JSON, [&](istream& in) {
+        json manifest;
+        in >> manifest;
+        _manifest = manifest.is_object() ? manifest : json::object();
+    });
+}
+
+void WebDashFingerprintStore::_Save(const string& taskid) {
+    const string directory = MyWorld().GetPersistenteStoragePath().string();
+    const string path = directory + "/" + kManifestFile;
+    const string lock_path = directory + "/" + kLockFile;
+
+    const int lock_fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (lock_fd < 0) {
+        perror("WebDashFingerprintStore::_Save!open");
+        MyWorld().Log(WebDash::LogType::ERR, "Fingerprints: failed opening " + lock_path + ". Not saved.");
+        return;
+    }
+
+    flock(lock_fd, LOCK_EX);
+
+    // Other invocations may have recorded their tasks meanwhile. An unreadable manifest is replaced by ours.
+    json merged = _manifest;
+    {
+        ifstream in(path, ios::binary);
+        json on_disk = json::parse(in, nullptr, false);
+        if (!on_disk.is_discarded() && on_disk.is_object())
+            merged = std::move(on_disk);
+    }
+
+    if (_manifest.contains(taskid))
+        merged[taskid] = _manifest[taskid];
+    else
+        merged.erase(taskid);
+
+    _manifest = std::move(merged);
+
+    const string staging_path = path + ".tmp-" + to_string(getpid());
+    const int fd = open(staging_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    const bool is_written = fd >= 0 && WriteAll(fd, _manifest.dump()) && fsync(fd) == 0;
+    if (fd >= 0)
+        close(fd);
+
+    if (!is_written || rename(staging_path.c_str(), path.c_str()) != 0) {
+        perror("WebDashFingerprintStore::_Save!rename");
+        MyWorld().Log(WebDash::LogType::ERR, "Fingerprints: failed writing " + path);
+        unlink(staging_path.c_str());
+    }
+
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+}
+
+bool WebDashFingerprintStore::_Matches(json& fingerprint, const string& path, bool& is_refreshed) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+        return false;
+
+    // Fast path: nothing touched the file.
+    if (fingerprint.value("size", (int64_t)-1) != (int64_t)st.st_size)
+        return false;
+    if (fingerprint.value("mtime", (int64_t)-1) == GetMtimeNs(st))
+        return true;
+
+    const auto hash = webdash::HashFile(path);
+    if (!hash.has_value() || fingerprint.value("hash", "") != webdash::ToHex(hash.value()))
+        return false;
+
+    fingerprint["mtime"] = GetMtimeNs(st);
+    is_refreshed = true;
+    return true;
+}
+
+json WebDashFingerprintStore::_Fingerprint(const vector<string>& paths, const json* previous) {
+    json ret = json::object();
+
+    for (const string& path : paths) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+            continue;
+
+        json fingerprint;
+        fingerprint["mtime"] = GetMtimeNs(st);
+        fingerprint["size"] = (int64_t)st.st_size;
+
+        if (previous != nullptr && previous->contains(path)) {
+            const json& old = (*previous)[path];
+            if (old.value("mtime", (int64_t)-1) == GetMtimeNs(st) && old.value("size", (int64_t)-1) == (int64_t)st.st_size) {
+                fingerprint["hash"] = old.value("hash", "");
+                ret[path] = fingerprint;
+                continue;
+            }
+        }
+
+        const auto hash = webdash::HashFile(path);
+        if (!hash.has_value()) {
+            WEBDASH_LOG(WebDash::LogType::WARN, "Fingerprints: failed reading " + path);
+            continue;
+        }
+
+        fingerprint["hash"] = webdash::ToHex(hash.value());
+        ret[path] = fingerprint;
+    }
+
+    return ret;
+}
@@ -0,0 +1,197 @@
+#include "webdash-logger.hpp"
+#include "webdash-core.hpp"
+
+#include <filesystem>
+#include <sstream>
+#include <sys/stat.h>
+using namespace std;
+
+
+namespace {
+    // Longest a record waits before being written, unless Flush() is called.
+    constexpr auto kFlushIntervalMs = std::chrono::milliseconds(100);
+
+    // Records kept until Open(). A process without a root never opens the logger, so later ones are dropped.
+    constexpr uint64_t kMaxHeldRecords = 1024;
+
+    string StringifyLogCode(LogCode err) {
+        std::stringstream stream;
+        stream << std::hex << (static_cast<int>(err));
+        return stream.str();
+    }
+}
+
+WebDashLogger::~WebDashLogger() {
+    if (_thread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _is_stopping = true;
+        }
+        _wakeup.notify_one();
+        _thread.join();
+    }
+
+    // Logged while stopping, or never opened (nowhere to write to).
+    if (!_directory.empty())
+        _Write(_TakeAll());
+
+    for (Record* record = _TakeAll(); record != nullptr;) {
+        Record* next = record->next;
+        delete record;
+        record = next;
+    }
+
+    for (auto& [type, file] : _files) {
+        if (file != nullptr)
+            fclose(file);
+    }
+}
+
+void WebDashLogger::Open(const string& directory) {
+    if (_thread.joinable())
+        return;
+
+    _directory = directory;
+
+    std::error_code ec;
+    std::filesystem::create_directories(_directory, ec);
+
+    _thread = std::thread(&WebDashLogger::_Loop, this);
+    _is_open = true;
+}
+
+void WebDashLogger::Log(WebDash::LogType type, string msg, LogCode logcode, bool append_if_possible) {
+    if (!_is_open && _held_records.fetch_add(1, std::memory_order_relaxed) >= kMaxHeldRecords)
+        return;
+
+    Record* record = new Record { type, logcode, append_if_possible, std::chrono::system_clock::now(), std::move(msg) };
+
+    record->next = _head.load(std::memory_order_relaxed);
+    while (!_head.compare_exchange_weak(record->next, record, std::memory_order_release, std::memory_order_relaxed)) {}
+}
+
+void WebDashLogger::Flush() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!_thread.joinable())
+        return;
+
+    const uint64_t ticket = ++_flush_requested;
+    _wakeup.notify_one();
+    _flushed.wait(lock, [&] { return _flush_done >= ticket; });
+}
+
+void WebDashLogger::_Loop() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true) {
+        _wakeup.wait_for(lock, kFlushIntervalMs, [&] { return _is_stopping || _flush_requested > _flush_done; });
+
+        // Everything pushed before these were read is taken below.
+        const uint64_t requested = _flush_requested;
+        const bool is_stopping = _is_stopping;
+
+        lock.unlock();
+        _Write(_TakeAll());
+        lock.lock();
+
+        if (requested > _flush_done) {
+            _flush_done = requested;
+            _flushed.notify_all();
+        }
+
+        if (is_stopping)
+            return;
+    }
+}
+
+WebDashLogger::Record* WebDashLogger::_TakeAll() {
+    Record* newest = _head.exchange(nullptr, std::memory_order_acquire);
+
+    // The list is newest first.
+    Record* oldest = nullptr;
+    while (newest != nullptr) {
+        Record* next = newest->next;
+        newest->next = oldest;
+        oldest = newest;
+        newest = next;
+    }
+
+    return oldest;
+}
+
+void WebDashLogger::_Write(Record* records) {
+    if (records == nullptr)
+        return;
+
+    // A log file deleted meanwhile is recreated, as the open handle would write nowhere.
+    for (auto& [type, file] : _files) {
+        struct stat st;
+        if (file != nullptr && fstat(fileno(file), &st) == 0 && st.st_nlink == 0) {
+            fclose(file);
+            file = nullptr;
+        }
+    }
+
+    while (records != nullptr) {
+        Record* record = records;
+        records = records->next;
+
+        const string& curr_time = _FormatTime(record->time);
+        FILE*& file = _files[record->type];
+        bool& is_initialized = _is_logtype_initialized[record->type];
+
+        // Program was newly started and our goal is not to append
+        // OR file is not open yet, then (re)open it.
+        const bool must_truncate = !is_initialized && !record->append_if_possible;
+        if (file == nullptr || must_truncate) {
+            if (file != nullptr)
+                fclose(file);
+
+            const string fpath = _directory + "/logging." + WebDash::kTypeToString.at(record->type) + ".txt";
+            file = fopen(fpath.c_str(), must_truncate ? "w" : "a");
+            if (file == nullptr) {
+                perror("WebDashLogger::_Write!fopen");
+                delete record;
+                continue;
+            }
+
+            struct stat st;
+            if (must_truncate || (fstat(fileno(file), &st) == 0 && st.st_size == 0))
+                fprintf(file, "%s %s: initialized this file.\n", StringifyLogCode(LogCode::N_INIT_LOG_FILE).c_str(), curr_time.c_str());
+
+            if (must_truncate)
+                is_initialized = true;
+        }
+
+        const string code = StringifyLogCode(record->logcode);
+        fwrite(code.data(), 1, code.size(), file);
+        fputc(' ', file);
+        fwrite(curr_time.data(), 1, curr_time.size(), file);
+        fwrite(": ", 1, 2, file);
+        fwrite(record->msg.data(), 1, record->msg.size(), file);
+        fputc('\n', file);
+
+        delete record;
+    }
+
+    for (auto& [type, file] : _files) {
+        if (file != nullptr)
+            fflush(file);
+    }
+}
+
+const string& WebDashLogger::_FormatTime(std::chrono::system_clock::time_point time) {
+    const std::time_t now_t = std::chrono::system_clock::to_time_t(time);
+    if (now_t != _formatted_second) {
+        std::tm tm;
+        localtime_r(&now_t, &tm);
+
+        char buffer[64];
+        const size_t len = strftime(buffer, sizeof(buffer), "%F %T", &tm);
+
+        _formatted_time.assign(buffer, len);
+        _formatted_second = now_t;
+    }
+
+    return _formatted_time;
+}
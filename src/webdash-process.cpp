@@ -0,0 +1,233 @@
+#include "webdash-process.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <spawn.h>
+#include <unistd.h>
+using namespace std;
+
+extern char **environ;
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+#define WEBDASH_HAS_SPAWN_CHDIR 1
+#endif
+
+namespace {
+#ifndef WEBDASH_HAS_SPAWN_CHDIR
+    // Between vfork and exec only async-signal-safe calls are made; nothing is allocated.
+    pid_t SpawnWithVfork(const webdash::LaunchSpec& spec, char* const* argv, char* const* envp) {
+        const char* wdir = spec.wdir.has_value() ? spec.wdir.value().c_str() : nullptr;
+
+        const pid_t pid = vfork();
+        if (pid == 0) {
+            if (spec.process_group.has_value() && setpgid(0, spec.process_group.value()) != 0)
+                _exit(127);
+            if (wdir != nullptr && chdir(wdir) != 0)
+                _exit(127);
+            if (spec.stdin_fd >= 0 && dup2(spec.stdin_fd, STDIN_FILENO) == -1)
+                _exit(127);
+            if (spec.stdout_fd >= 0 && dup2(spec.stdout_fd, STDOUT_FILENO) == -1)
+                _exit(127);
+            if (spec.stderr_fd >= 0 && dup2(spec.stderr_fd, STDERR_FILENO) == -1)
+                _exit(127);
+
+            execvpe(argv[0], argv, envp);
+            _exit(127);
+        }
+
+        return pid;
+    }
+#endif
+}
+
+std::optional<webdash::Command> webdash::Command::Parse(const string& line, string* error) {
+    auto fail = [&](const string& reason) -> std::optional<Command> {
+        if (error != nullptr)
+            *error = reason;
+        return nullopt;
+    };
+
+    vector<string> args;
+    string current;
+    bool in_word = false;
+
+    const size_t n = line.size();
+    size_t i = 0;
+    while (i < n) {
+        const char c = line[i];
+
+        if (c == ' ' || c == '\t' || c == '\n') {
+            if (in_word)
+                args.push_back(std::move(current));
+            current.clear();
+            in_word = false;
+            i++;
+            continue;
+        }
+
+        if (c == '\\') {
+            if (i + 1 >= n)
+                return fail("trailing backslash");
+
+            // Line continuation.
+            if (line[i + 1] != '\n') {
+                current += line[i + 1];
+                in_word = true;
+            }
+
+            i += 2;
+            continue;
+        }
+
+        in_word = true;
+
+        if (c == '\'') {
+            const size_t end = line.find('\'', i + 1);
+            if (end == string::npos)
+                return fail("unterminated '");
+
+            current.append(line, i + 1, end - i - 1);
+            i = end + 1;
+            continue;
+        }
+
+        if (c == '"') {
+            for (i++; i < n && line[i] != '"'; i++) {
+                if (line[i] == '\\' && i + 1 < n && string("\"\\$`\n").find(line[i + 1]) != string::npos) {
+                    if (line[i + 1] != '\n')
+                        current += line[i + 1];
+                    i++;
+                } else {
+                    current += line[i];
+                }
+            }
+
+            if (i >= n)
+                return fail("unterminated \"");
+
+            i++;
+            continue;
+        }
+
+        current += c;
+        i++;
+    }
+
+    if (in_word)
+        args.push_back(std::move(current));
+
+    return FromArgv(args, line);
+}
+
+webdash::Command webdash::Command::FromArgv(const vector<string>& args, const string& text) {
+    auto block = std::make_shared<Block>();
+
+    size_t size = 0;
+    for (const string& arg : args)
+        size += arg.size() + 1;
+
+    // The buffer is final before pointers into it are taken.
+    block->storage.reserve(size);
+    for (const string& arg : args)
+        block->storage.append(arg.c_str(), arg.size() + 1);
+
+    for (size_t offset = 0; offset < block->storage.size(); offset += strlen(&block->storage[offset]) + 1)
+        block->argv.push_back(&block->storage[offset]);
+    block->argv.push_back(nullptr);
+
+    Command ret;
+    ret._text = text;
+    ret._block = std::move(block);
+    return ret;
+}
+
+char* const* webdash::Command::GetArgv() const {
+    static char* const kEmpty[] = { nullptr };
+    return _block ? _block->argv.data() : kEmpty;
+}
+
+size_t webdash::Command::GetArgc() const {
+    return _block ? _block->argv.size() - 1 : 0;
+}
+
+std::shared_ptr<const webdash::Environment> webdash::Environment::Build(const vector<pair<string, string>>& additions) {
+    vector<string> entries;
+    for (char** entry = environ; *entry != nullptr; ++entry) {
+        const string variable = *entry;
+        const string name = variable.substr(0, variable.find('='));
+
+        bool is_overridden = false;
+        for (const auto& addition : additions)
+            is_overridden |= addition.first == name;
+
+        if (!is_overridden)
+            entries.push_back(variable);
+    }
+
+    for (const auto& [name, value] : additions)
+        entries.push_back(name + "=" + value);
+
+    std::shared_ptr<Environment> ret(new Environment());
+    ret->_additions = additions;
+
+    size_t size = 0;
+    for (const string& entry : entries)
+        size += entry.size() + 1;
+
+    ret->_storage.reserve(size);
+    for (const string& entry : entries)
+        ret->_storage.append(entry.c_str(), entry.size() + 1);
+
+    for (size_t offset = 0; offset < ret->_storage.size(); offset += strlen(&ret->_storage[offset]) + 1)
+        ret->_envp.push_back(&ret->_storage[offset]);
+    ret->_envp.push_back(nullptr);
+
+    return ret;
+}
+
+pid_t webdash::Spawn(const LaunchSpec& spec) {
+    if (spec.command.GetArgc() == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    char* const* argv = spec.command.GetArgv();
+    char* const* envp = spec.environment ? spec.environment->GetEnvp() : environ;
+
+#ifndef WEBDASH_HAS_SPAWN_CHDIR
+    return SpawnWithVfork(spec, argv, envp);
+#else
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+
+    if (spec.wdir.has_value())
+        posix_spawn_file_actions_addchdir_np(&actions, spec.wdir.value().c_str());
+    if (spec.stdin_fd >= 0)
+        posix_spawn_file_actions_adddup2(&actions, spec.stdin_fd, STDIN_FILENO);
+    if (spec.stdout_fd >= 0)
+        posix_spawn_file_actions_adddup2(&actions, spec.stdout_fd, STDOUT_FILENO);
+    if (spec.stderr_fd >= 0)
+        posix_spawn_file_actions_adddup2(&actions, spec.stderr_fd, STDERR_FILENO);
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+
+    if (spec.process_group.has_value()) {
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+        posix_spawnattr_setpgroup(&attr, spec.process_group.value());
+    }
+
+    pid_t pid = -1;
+    const int err = posix_spawnp(&pid, argv[0], &actions, &attr, argv, envp);
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+
+    return pid;
+#endif
+}
@@ -0,0 +1,295 @@
+#include "webdash-run-state.hpp"
+#include "webdash-core.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace std;
+
+
+namespace {
+    const string kSnapshotFile = "run-state.snapshot";
+    const string kLogFile = "run-state.log";
+    const string kSnapshotHeader = "webdash-run-state 1";
+
+    // Log records after which the state is written to a fresh snapshot.
+    constexpr size_t kCompactionThreshold = 4096;
+
+    int64_t ToMs(std::chrono::system_clock::time_point when) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(when.time_since_epoch()).count();
+    }
+
+    string ReadFile(const string& path) {
+        ifstream in(path, ios::binary);
+        return string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    // Reads {fd} from {offset} to its end.
+    string ReadFrom(int fd, off_t offset) {
+        string ret;
+        char buffer[1 << 16];
+
+        while (true) {
+            const ssize_t count = pread(fd, buffer, sizeof(buffer), offset);
+            if (count < 0 && errno == EINTR)
+                continue;
+            if (count <= 0)
+                break;
+
+            ret.append(buffer, count);
+            offset += count;
+        }
+
+        return ret;
+    }
+
+    // Length of the complete lines at the start of {data}.
+    size_t GetCompleteLength(const string& data) {
+        const size_t last_newline = data.rfind('\n');
+        return last_newline == string::npos ? 0 : last_newline + 1;
+    }
+
+    bool WriteAll(int fd, const string& data) {
+        size_t written = 0;
+        while (written < data.size()) {
+            const ssize_t count = write(fd, data.data() + written, data.size() - written);
+            if (count < 0) {
+                if (errno == EINTR)
+                    continue;
+                return false;
+            }
+            written += count;
+        }
+        return true;
+    }
+}
+
+/* static */ WebDashRunStateStore& WebDashRunStateStore::Get() {
+    static WebDashRunStateStore store;
+    return store;
+}
+
+WebDashRunStateStore::~WebDashRunStateStore() {
+    if (_log_fd >= 0)
+        close(_log_fd);
+}
+
+std::optional<webdash::RunState> WebDashRunStateStore::Find(const string& taskid) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _Load();
+
+    // Other processes may have run the task meanwhile.
+    if (_log_fd >= 0) {
+        flock(_log_fd, LOCK_SH);
+        _Refresh();
+        flock(_log_fd, LOCK_UN);
+    }
+
+    auto it = _states.find(taskid);
+    if (it == _states.end())
+        return nullopt;
+
+    return it->second;
+}
+
+void WebDashRunStateStore::RecordStart(const string& taskid, std::chrono::system_clock::time_point when) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _Load();
+
+    // An increment, so that concurrent processes don't lose each other's runs.
+    _Append("S " + to_string(ToMs(when)) + " +1 " + taskid + "\n");
+}
+
+void WebDashRunStateStore::RecordEnd(const string& taskid, std::chrono::system_clock::time_point when, int result) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _Load();
+
+    _Append("E " + to_string(ToMs(when)) + " " + to_string(result) + " " + taskid + "\n");
+}
+
+void WebDashRunStateStore::_Load() {
+    if (_is_loaded)
+        return;
+
+    _is_loaded = true;
+
+    const string directory = MyWorld().GetPersistenteStoragePath().string();
+    _snapshot_path = directory + "/" + kSnapshotFile;
+    _log_path = directory + "/" + kLogFile;
+
+    _log_fd = open(_log_path.c_str(), O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (_log_fd < 0) {
+        perror("WebDashRunStateStore!open");
+        MyWorld().Log(WebDash::LogType::ERR, "Run state: failed opening " + _log_path + ". State is not persisted.");
+        _ReadFromDisk(false);
+        return;
+    }
+
+    flock(_log_fd, LOCK_EX);
+    _ReadFromDisk(true);
+    flock(_log_fd, LOCK_UN);
+}
+
+void WebDashRunStateStore::_ReadFromDisk(bool may_truncate) {
+    _states.clear();
+
+    {
+        _snapshot_version = _GetSnapshotVersion();
+        istringstream snapshot(ReadFile(_snapshot_path));
+
+        string line;
+        getline(snapshot, line);
+        if (!line.empty() && line != kSnapshotHeader) {
+            MyWorld().Log(WebDash::LogType::ERR, "Run state: unknown snapshot format in " + _snapshot_path + ". Ignored.");
+        } else {
+            while (getline(snapshot, line)) {
+                istringstream fields(line);
+                webdash::RunState state;
+                string taskid;
+                if (fields >> state.last_start >> state.last_end >> state.last_result >> state.run_count && getline(fields >> ws, taskid))
+                    _states[taskid] = state;
+            }
+        }
+    }
+
+    const string log = ReadFile(_log_path);
+
+    // A crash may leave a torn last line behind. With the exclusive lock it is cut off, so that the next
+    // append starts on a fresh line. Otherwise it may be a record still being written.
+    const size_t valid_length = GetCompleteLength(log);
+    if (valid_length < log.size() && _log_fd >= 0 && may_truncate) {
+        WEBDASH_LOG(WebDash::LogType::WARN, "Run state: dropping a torn record from " + _log_path);
+        if (ftruncate(_log_fd, valid_length) != 0)
+            perror("WebDashRunStateStore!ftruncate");
+    }
+
+    _log_records = _Replay(log.substr(0, valid_length));
+    _log_offset = valid_length;
+}
+
+void WebDashRunStateStore::_Refresh() {
+    struct stat st;
+    if (fstat(_log_fd, &st) != 0)
+        return;
+
+    // Compacted by another process: the log was truncated and the snapshot replaced.
+    if (_GetSnapshotVersion() != _snapshot_version || (size_t)st.st_size < _log_offset) {
+        _ReadFromDisk(false);
+        return;
+    }
+
+    if ((size_t)st.st_size == _log_offset)
+        return;
+
+    const string tail = ReadFrom(_log_fd, _log_offset);
+    const size_t length = GetCompleteLength(tail);
+
+    _log_records += _Replay(tail.substr(0, length));
+    _log_offset += length;
+}
+
+size_t WebDashRunStateStore::_Replay(const string& lines) {
+    size_t records = 0;
+
+    istringstream stream(lines);
+    string line;
+    while (getline(stream, line)) {
+        istringstream fields(line);
+        char type;
+        int64_t when;
+        string value;
+        string taskid;
+        if (!(fields >> type >> when >> value) || !getline(fields >> ws, taskid))
+            continue;
+
+        const int64_t number = strtoll(value.c_str(), nullptr, 10);
+
+        webdash::RunState& state = _states[taskid];
+        if (type == 'S') {
+            state.last_start = max(state.last_start, when);
+
+            // Older versions logged the count itself.
+            state.run_count = value[0] == '+' ? state.run_count + number : number;
+        } else if (type == 'E' && when >= state.last_end) {
+            state.last_end = when;
+            state.last_result = number;
+        }
+
+        records++;
+    }
+
+    return records;
+}
+
+std::pair<int64_t, int64_t> WebDashRunStateStore::_GetSnapshotVersion() const {
+    struct stat st;
+    if (stat(_snapshot_path.c_str(), &st) != 0)
+        return { 0, 0 };
+
+    return { (int64_t)st.st_ino, (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec };
+}
+
+void WebDashRunStateStore::_Append(const string& line) {
+    if (_log_fd < 0) {
+        _Replay(line);
+        return;
+    }
+
+    // Appends of different processes don't interleave (O_APPEND), but must not race with compaction.
+    // Our record is taken in by reading the log, along with those of others before it.
+    flock(_log_fd, LOCK_SH);
+    _Refresh();
+    if (!WriteAll(_log_fd, line))
+        perror("WebDashRunStateStore!write");
+    _Refresh();
+    flock(_log_fd, LOCK_UN);
+
+    if (_log_records >= kCompactionThreshold)
+        _Compact();
+}
+
+void WebDashRunStateStore::_Compact() {
+    flock(_log_fd, LOCK_EX);
+
+    // Other processes may have appended meanwhile.
+    _ReadFromDisk(true);
+
+    string data = kSnapshotHeader + "\n";
+    for (const auto& [taskid, state] : _states) {
+        data += to_string(state.last_start) + " " + to_string(state.last_end) + " " + to_string(state.last_result) + " " +
+                to_string(state.run_count) + " " + taskid + "\n";
+    }
+
+    const string staging_path = _snapshot_path + ".tmp-" + to_string(getpid());
+    const int fd = open(staging_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    // The log may only go once the snapshot is durable.
+    const bool is_written = fd >= 0 && WriteAll(fd, data) && fsync(fd) == 0;
+    if (fd >= 0)
+        close(fd);
+
+    if (is_written && rename(staging_path.c_str(), _snapshot_path.c_str()) == 0) {
+        if (ftruncate(_log_fd, 0) != 0)
+            perror("WebDashRunStateStore!ftruncate");
+
+        _snapshot_version = _GetSnapshotVersion();
+        _log_offset = 0;
+    } else {
+        perror("WebDashRunStateStore!snapshot");
+        MyWorld().Log(WebDash::LogType::ERR, "Run state: failed writing the snapshot " + _snapshot_path);
+        unlink(staging_path.c_str());
+    }
+
+    // Retried after the next batch of records if it failed.
+    _log_records = 0;
+
+    flock(_log_fd, LOCK_UN);
+}
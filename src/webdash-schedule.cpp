@@ -0,0 +1,211 @@
+#include "webdash-schedule.hpp"
+
+#include <cstdlib>
+#include <ctime>
+#include <iterator>
+#include <sstream>
+#include <vector>
+using namespace std;
+
+
+namespace {
+    constexpr time_t kSecondsPerDay = 24 * 60 * 60;
+
+    // Cron expressions that match nothing (e.g. February 30th) are given up on after this many years.
+    constexpr int kCronSearchYears = 5;
+
+    // Parses one cron field into {bits} (bit i = value i). Values must lie within [lo, hi].
+    bool ParseCronField(const string& field, int lo, int hi, uint64_t& bits) {
+        bits = 0;
+
+        stringstream items(field);
+        string item;
+        while (getline(items, item, ',')) {
+            if (item.empty())
+                return false;
+
+            int step = 1;
+            const size_t slash = item.find('/');
+            if (slash != string::npos) {
+                char* end = nullptr;
+                step = strtol(item.c_str() + slash + 1, &end, 10);
+                if (*end != '\0' || end == item.c_str() + slash + 1 || step <= 0)
+                    return false;
+                item = item.substr(0, slash);
+            }
+
+            int first = lo;
+            int last = hi;
+            if (item != "*") {
+                char* end = nullptr;
+                first = strtol(item.c_str(), &end, 10);
+                if (end == item.c_str())
+                    return false;
+
+                if (*end == '-') {
+                    const char* begin = end + 1;
+                    last = strtol(begin, &end, 10);
+                    if (end == begin)
+                        return false;
+                } else {
+                    // "a/n" runs from a to the end of the range.
+                    last = slash != string::npos ? hi : first;
+                }
+
+                if (*end != '\0')
+                    return false;
+            }
+
+            if (first < lo || last > hi || first > last)
+                return false;
+
+            for (int value = first; value <= last; value += step)
+                bits |= 1ull << value;
+        }
+
+        return bits != 0;
+    }
+
+    void Normalize(tm& local) {
+        local.tm_isdst = -1;
+        const time_t t = mktime(&local);
+        localtime_r(&t, &local);
+    }
+}
+
+std::optional<webdash::CronExpression> webdash::CronExpression::Parse(const string& expression) {
+    istringstream iss(expression);
+    vector<string> fields { istream_iterator<string>(iss), istream_iterator<string>() };
+    if (fields.size() != 5)
+        return nullopt;
+
+    CronExpression ret;
+    uint64_t bits = 0;
+
+    if (!ParseCronField(fields[0], 0, 59, ret._minutes))
+        return nullopt;
+
+    if (!ParseCronField(fields[1], 0, 23, bits))
+        return nullopt;
+    ret._hours = bits;
+
+    if (!ParseCronField(fields[2], 1, 31, bits))
+        return nullopt;
+    ret._days_of_month = bits;
+
+    if (!ParseCronField(fields[3], 1, 12, bits))
+        return nullopt;
+    ret._months = bits;
+
+    if (!ParseCronField(fields[4], 0, 7, bits))
+        return nullopt;
+    // Sunday is both 0 and 7.
+    if (bits & (1ull << 7))
+        bits |= 1;
+    ret._days_of_week = bits & 0x7f;
+
+    ret._is_dom_restricted = fields[2][0] != '*';
+    ret._is_dow_restricted = fields[4][0] != '*';
+
+    return ret;
+}
+
+std::chrono::system_clock::time_point webdash::CronExpression::NextMatch(std::chrono::system_clock::time_point after) const {
+    time_t t = std::chrono::system_clock::to_time_t(after);
+    t = t - t % 60 + 60;
+
+    tm local;
+    localtime_r(&t, &local);
+    const int last_year = local.tm_year + kCronSearchYears;
+
+    while (local.tm_year <= last_year) {
+        if (!(_months & (1u << (local.tm_mon + 1)))) {
+            local.tm_mon++;
+            local.tm_mday = 1;
+            local.tm_hour = 0;
+            local.tm_min = 0;
+            Normalize(local);
+            continue;
+        }
+
+        const bool dom_matches = _days_of_month & (1u << local.tm_mday);
+        const bool dow_matches = _days_of_week & (1u << local.tm_wday);
+        const bool day_matches = (_is_dom_restricted && _is_dow_restricted) ? (dom_matches || dow_matches) : (dom_matches && dow_matches);
+        if (!day_matches) {
+            local.tm_mday++;
+            local.tm_hour = 0;
+            local.tm_min = 0;
+            Normalize(local);
+            continue;
+        }
+
+        if (!(_hours & (1u << local.tm_hour))) {
+            local.tm_hour++;
+            local.tm_min = 0;
+            Normalize(local);
+            continue;
+        }
+
+        if (!(_minutes & (1ull << local.tm_min))) {
+            local.tm_min++;
+            Normalize(local);
+            continue;
+        }
+
+        local.tm_isdst = -1;
+        return std::chrono::system_clock::from_time_t(mktime(&local));
+    }
+
+    return std::chrono::system_clock::time_point::max();
+}
+
+webdash::Schedule webdash::Schedule::Compile(const std::optional<string>& frequency, const string& when) {
+    Schedule ret;
+    ret._on_new_day = when == "new-day";
+
+    if (!frequency.has_value())
+        return ret;
+
+    const string& value = frequency.value();
+
+    if (value == "daily") {
+        ret._kind = Kind::Interval;
+        ret._interval = std::chrono::hours(24);
+        return ret;
+    }
+
+    char* end = nullptr;
+    const double ms = strtod(value.c_str(), &end);
+    if (end != value.c_str() && *end == '\0') {
+        ret._kind = Kind::Interval;
+        ret._is_valid = ms >= 0 && ms < 1e15;
+        ret._interval = std::chrono::milliseconds(ret._is_valid ? (int64_t)ms : 0);
+        return ret;
+    }
+
+    ret._kind = Kind::Cron;
+    ret._cron = CronExpression::Parse(value);
+    ret._is_valid = ret._cron.has_value();
+    return ret;
+}
+
+webdash::Schedule::TimePoint webdash::Schedule::NextDue(TimePoint last_start) const {
+    if (!_is_valid)
+        return TimePoint::max();
+
+    const bool has_run = last_start != TimePoint();
+
+    TimePoint due = last_start;
+    if (_kind == Kind::Interval)
+        due = last_start + _interval;
+    else if (_kind == Kind::Cron && has_run)
+        due = _cron->NextMatch(last_start);
+
+    if (_on_new_day && has_run) {
+        time_t t = std::chrono::system_clock::to_time_t(last_start);
+        t = t - t % kSecondsPerDay + kSecondsPerDay;
+        due = max(due, std::chrono::system_clock::from_time_t(t));
+    }
+
+    return due;
+}
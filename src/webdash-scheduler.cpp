@@ -0,0 +1,131 @@
+#include "webdash-scheduler.hpp"
+#include "webdash-config.hpp"
+#include "webdash-core.hpp"
+
+using namespace std;
+
+
+WebDashScheduler::WebDashScheduler(vector<WebDashConfigTask*> tasks, webdash::RunConfig config)
+    : _config(config), _origin(std::chrono::system_clock::now()) {
+    _SetTasks(tasks);
+}
+
+bool WebDashScheduler::Watch(WebDashConfig* config) {
+    _watched = config;
+    _watcher = std::make_unique<WebDashConfigWatcher>([this]() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _is_reload_pending = true;
+        _wakeup.notify_all();
+    });
+
+    return _watcher->Watch(config);
+}
+
+void WebDashScheduler::Run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    for (size_t i = 0; i < _tasks.size(); ++i)
+        _Reschedule(i);
+
+    WEBDASH_LOG(WebDash::LogType::INFO, "Scheduler: " + to_string(_tasks.size()) + " timed task(s).");
+
+    while (true) {
+        for (size_t index : _finished)
+            _Reschedule(index);
+        _finished.clear();
+
+        if (_is_stopped) {
+            _wakeup.wait(lock, [this]() { return _running == 0; });
+            return;
+        }
+
+        if (_is_reload_pending && _running == 0) {
+            _is_reload_pending = false;
+            _Reload();
+        }
+
+        // A pending reload waits for the runs in flight; no new ones are started meanwhile.
+        vector<uint64_t> due;
+        if (!_is_reload_pending)
+            due = _wheel.Advance(_ToTick(std::chrono::system_clock::now()));
+        _running += due.size();
+
+        // Completion callbacks take the lock, and may run right away.
+        lock.unlock();
+        for (uint64_t index : due) {
+            WEBDASH_LOG(WebDash::LogType::DEBUG, "Scheduler: " + _tasks[index]->GetTaskId() + " is due.");
+
+            _tasks[index]->RunAsync(_config).OnDone([this, index](const webdash::RunReturn&) {
+                std::lock_guard<std::mutex> guard(_mutex);
+                _finished.push_back(index);
+                _running--;
+                _wakeup.notify_all();
+            });
+        }
+        lock.lock();
+
+        if (!_finished.empty() || _is_stopped)
+            continue;
+
+        const auto next = _wheel.NextExpiry();
+        if (_is_reload_pending)
+            _wakeup.wait(lock);
+        else if (next.has_value())
+            _wakeup.wait_until(lock, _FromTick(next.value()));
+        else
+            _wakeup.wait(lock);
+    }
+}
+
+void WebDashScheduler::Stop() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _is_stopped = true;
+    _wakeup.notify_all();
+}
+
+void WebDashScheduler::_Reload() {
+    if (!_watcher->Apply())
+        return;
+
+    for (size_t i = 0; i < _tasks.size(); ++i)
+        _wheel.Cancel(i);
+
+    _SetTasks(_watched->GetTasks());
+    for (size_t i = 0; i < _tasks.size(); ++i)
+        _Reschedule(i);
+
+    WEBDASH_LOG(WebDash::LogType::INFO, "Scheduler: reloaded, " + to_string(_tasks.size()) + " timed task(s).");
+}
+
+void WebDashScheduler::_SetTasks(const vector<WebDashConfigTask*>& tasks) {
+    _tasks.clear();
+    for (WebDashConfigTask* task : tasks) {
+        if (task->GetSchedule().IsTimed() && task->GetSchedule().IsValid())
+            _tasks.push_back(task);
+    }
+}
+
+uint64_t WebDashScheduler::_ToTick(TimePoint when) const {
+    if (when <= _origin)
+        return 0;
+
+    // Due times too far away to matter (e.g. time_point::max()) end up at the wheel's horizon.
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(when - _origin).count();
+    return min<uint64_t>(ms, webdash::TimerWheel::kHorizon - 1);
+}
+
+WebDashScheduler::TimePoint WebDashScheduler::_FromTick(uint64_t tick) const {
+    return _origin + std::chrono::milliseconds(tick);
+}
+
+void WebDashScheduler::_Reschedule(size_t index) {
+    const TimePoint due = _tasks[index]->GetNextDue();
+
+    // A cron expression matching nothing is never due.
+    if (due == TimePoint::max())
+        return;
+
+    // Due times are rounded up: a task is never started before it is due.
+    const uint64_t tick = _ToTick(due + std::chrono::milliseconds(1) - std::chrono::nanoseconds(1));
+    _wheel.Schedule(index, tick);
+}
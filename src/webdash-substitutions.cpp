@@ -0,0 +1,184 @@
+#include "webdash-substitutions.hpp"
+
+#include <algorithm>
+using namespace std;
+
+
+webdash::Substitutions::Substitutions() {
+    _first.fill(-1);
+}
+
+webdash::Substitutions::Substitutions(const vector<pair<string, string>>& definitions) : Substitutions() {
+    for (const auto& [key, value] : definitions) {
+        // An empty key would match everywhere.
+        if (key.empty())
+            continue;
+
+        int32_t& first = _first[(unsigned char)key[0]];
+        if (first < 0) {
+            first = _nodes.size();
+            _nodes.emplace_back();
+        }
+
+        int32_t node = first;
+        for (size_t i = 1; i < key.size(); ++i) {
+            const unsigned char c = key[i];
+            auto& children = _nodes[node].children;
+            auto it = std::lower_bound(children.begin(), children.end(), make_pair(c, (int32_t)-1));
+
+            if (it != children.end() && it->first == c) {
+                node = it->second;
+            } else {
+                // Inserted before growing _nodes, which moves {children}.
+                node = _nodes.size();
+                children.insert(it, make_pair(c, node));
+                _nodes.emplace_back();
+            }
+        }
+
+        if (_nodes[node].key < 0) {
+            _nodes[node].key = _keys.size();
+            _keys.push_back(key);
+            _raw_values.push_back(value);
+        }
+    }
+
+    _values.resize(_keys.size());
+    _dependencies.resize(_keys.size());
+
+    vector<char> state(_keys.size(), 0);
+    for (size_t i = 0; i < _keys.size(); ++i)
+        _Resolve(i, state);
+}
+
+pair<int32_t, size_t> webdash::Substitutions::_Match(const string& text, size_t pos) const {
+    int32_t node = _first[(unsigned char)text[pos]];
+    int32_t key = -1;
+    size_t len = 0;
+
+    for (size_t i = pos + 1; node >= 0; ++i) {
+        if (_nodes[node].key >= 0) {
+            key = _nodes[node].key;
+            len = i - pos;
+        }
+
+        if (i == text.size())
+            break;
+
+        const auto& children = _nodes[node].children;
+        const unsigned char c = text[i];
+        auto it = std::lower_bound(children.begin(), children.end(), make_pair(c, (int32_t)-1));
+        node = (it != children.end() && it->first == c) ? it->second : -1;
+    }
+
+    return make_pair(key, len);
+}
+
+void webdash::Substitutions::_Resolve(size_t index, vector<char>& state) {
+    if (state[index] != 0)
+        return;
+
+    state[index] = 1;
+
+    const string& raw = _raw_values[index];
+    string value;
+    vector<int32_t> dependencies;
+
+    size_t literal_start = 0;
+    for (size_t i = 0; i < raw.size();) {
+        const auto [key, len] = _first[(unsigned char)raw[i]] >= 0 ? _Match(raw, i) : make_pair((int32_t)-1, (size_t)0);
+
+        // Cycles are left unresolved.
+        if (key < 0 || state[key] == 1) {
+            i += (key < 0) ? 1 : len;
+            continue;
+        }
+
+        _Resolve(key, state);
+
+        value.append(raw, literal_start, i - literal_start);
+        value += _values[key];
+        dependencies.push_back(key);
+        dependencies.insert(dependencies.end(), _dependencies[key].begin(), _dependencies[key].end());
+
+        i += len;
+        literal_start = i;
+    }
+    value.append(raw, literal_start, string::npos);
+
+    std::sort(dependencies.begin(), dependencies.end());
+    dependencies.erase(std::unique(dependencies.begin(), dependencies.end()), dependencies.end());
+
+    _values[index] = std::move(value);
+    _dependencies[index] = std::move(dependencies);
+    state[index] = 2;
+}
+
+webdash::Substitutions::Template webdash::Substitutions::Parse(const string& text) const {
+    Template tmpl;
+
+    size_t literal_start = 0;
+    for (size_t i = 0; i < text.size();) {
+        const auto [key, len] = _first[(unsigned char)text[i]] >= 0 ? _Match(text, i) : make_pair((int32_t)-1, (size_t)0);
+        if (key < 0) {
+            i++;
+            continue;
+        }
+
+        if (i > literal_start)
+            tmpl.segments.push_back(Template::Segment { text.substr(literal_start, i - literal_start), -1 });
+        tmpl.segments.push_back(Template::Segment { "", key });
+
+        i += len;
+        literal_start = i;
+    }
+
+    if (literal_start < text.size())
+        tmpl.segments.push_back(Template::Segment { text.substr(literal_start), -1 });
+
+    return tmpl;
+}
+
+string webdash::Substitutions::Expand(const Template& tmpl) const {
+    string ret;
+    for (const auto& segment : tmpl.segments)
+        ret += (segment.key < 0) ? segment.literal : _values[segment.key];
+    return ret;
+}
+
+string webdash::Substitutions::Apply(const string& text) const {
+    string ret;
+
+    size_t literal_start = 0;
+    for (size_t i = 0; i < text.size();) {
+        const auto [key, len] = _first[(unsigned char)text[i]] >= 0 ? _Match(text, i) : make_pair((int32_t)-1, (size_t)0);
+        if (key < 0) {
+            i++;
+            continue;
+        }
+
+        ret.append(text, literal_start, i - literal_start);
+        ret += _values[key];
+
+        i += len;
+        literal_start = i;
+    }
+
+    // Nothing replaced: no need to copy piecewise.
+    if (literal_start == 0)
+        return text;
+
+    ret.append(text, literal_start, string::npos);
+    return ret;
+}
+
+void webdash::Substitutions::CollectReferences(const Template& tmpl, vector<bool>& referenced) const {
+    for (const auto& segment : tmpl.segments) {
+        if (segment.key < 0)
+            continue;
+
+        referenced[segment.key] = true;
+        for (int32_t dependency : _dependencies[segment.key])
+            referenced[dependency] = true;
+    }
+}
@@ -0,0 +1,430 @@
+#include "webdash-supervisor.hpp"
+#include "webdash-core.hpp"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+using namespace std;
+
+
+namespace {
+    // Upper bound of bytes taken from one pipe per wake-up, so that a single chatty child
+    // can't starve the others.
+    constexpr size_t kPumpBudget = 1 << 20;
+
+    constexpr int kMaxEvents = 64;
+
+    // Time a terminated child gets to shut down before it is killed.
+    constexpr std::chrono::seconds kTerminateGracePeriod(5);
+
+    // Linux >= 5.3. Not every C library ships a wrapper.
+    int OpenPidFd(pid_t pid) {
+#ifdef SYS_pidfd_open
+        return syscall(SYS_pidfd_open, pid, 0);
+#else
+        /* unused */ (void) pid;
+        errno = ENOSYS;
+        return -1;
+#endif
+    }
+}
+
+/* static */ WebDashSupervisor& WebDashSupervisor::Get() {
+    static WebDashSupervisor supervisor;
+    return supervisor;
+}
+
+WebDashSupervisor::WebDashSupervisor() {
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    _wakeup_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    _timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+
+    if (_epoll_fd < 0 || _wakeup_fd < 0 || _timer_fd < 0) {
+        perror("WebDashSupervisor!epoll");
+        MyWorld().Log(WebDash::LogType::ERR, "Supervisor: failed to create the event loop.");
+        return;
+    }
+
+    // The wake-up and timer descriptors are told apart from slots by their payload.
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = &_wakeup_fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _wakeup_fd, &ev);
+
+    ev.data.ptr = &_timer_fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _timer_fd, &ev);
+
+    _thread = std::thread(&WebDashSupervisor::_Loop, this);
+}
+
+WebDashSupervisor::~WebDashSupervisor() {
+    if (_thread.joinable()) {
+        const uint64_t one = 1;
+        if (write(_wakeup_fd, &one, sizeof(one)) == sizeof(one))
+            _thread.join();
+        else
+            _thread.detach();
+    }
+
+    if (_timer_fd >= 0)
+        close(_timer_fd);
+    if (_wakeup_fd >= 0)
+        close(_wakeup_fd);
+    if (_epoll_fd >= 0)
+        close(_epoll_fd);
+}
+
+uint64_t WebDashSupervisor::Launch(vector<webdash::LaunchSpec> stages,
+                                   bool collect_output,
+                                   std::shared_ptr<webdash::OutputSink> sink,
+                                   const string& taskid,
+                                   std::optional<std::chrono::milliseconds> timeout,
+                                   std::function<void(webdash::RunReturn)> on_exit) {
+    if (stages.empty()) {
+        errno = EINVAL;
+        return 0;
+    }
+
+    const bool capture = collect_output || sink != nullptr;
+
+    // One pipe per stream, so stdout and stderr stay distinguishable. All ends are closed automatically
+    // on exec, so children spawned concurrently by other threads don't inherit them.
+    int out_pipe[2] = { -1, -1 };
+    int err_pipe[2] = { -1, -1 };
+    if (capture) {
+        if (pipe2(out_pipe, O_CLOEXEC | O_NONBLOCK) == -1 || pipe2(err_pipe, O_CLOEXEC | O_NONBLOCK) == -1) {
+            // E.g. out of descriptors: fails this launch, like a failed spawn.
+            const int pipe_errno = errno;
+            perror("WebDashSupervisor::Launch!pipe2");
+
+            for (int fd : { out_pipe[0], out_pipe[1], err_pipe[0], err_pipe[1] })
+                if (fd >= 0)
+                    close(fd);
+
+            errno = pipe_errno;
+            return 0;
+        }
+        webdash::EnlargePipe(out_pipe[0]);
+
+        // The children get blocking ends.
+        fcntl(out_pipe[1], F_SETFL, 0);
+        fcntl(err_pipe[1], F_SETFL, 0);
+
+        stages.back().stdout_fd = out_pipe[1];
+        for (webdash::LaunchSpec& spec : stages)
+            spec.stderr_fd = err_pipe[1];
+    }
+
+    vector<pid_t> pids;
+    int spawn_errno = 0;
+
+    // Read end of the pipe between the previous stage and the current one.
+    int stage_input = -1;
+
+    for (size_t i = 0; i < stages.size(); ++i) {
+        webdash::LaunchSpec& spec = stages[i];
+
+        int stage_pipe[2] = { -1, -1 };
+        if (i + 1 < stages.size()) {
+            if (pipe2(stage_pipe, O_CLOEXEC) == -1) {
+                spawn_errno = errno;
+                break;
+            }
+            webdash::EnlargePipe(stage_pipe[1]);
+            spec.stdout_fd = stage_pipe[1];
+        }
+        spec.stdin_fd = stage_input;
+
+        // Own process group, so that termination reaches everything the stages spawn. The first stage
+        // leads it; it is not reaped before all stages are spawned, so the group exists until then.
+        spec.process_group = pids.empty() ? 0 : pids.front();
+
+        const pid_t pid = webdash::Spawn(spec);
+        spawn_errno = errno;
+
+        if (stage_input >= 0)
+            close(stage_input);
+        if (stage_pipe[1] >= 0)
+            close(stage_pipe[1]);
+        stage_input = stage_pipe[0];
+
+        if (pid < 0)
+            break;
+
+        pids.push_back(pid);
+    }
+
+    if (stage_input >= 0)
+        close(stage_input);
+
+    if (capture) {
+        close(out_pipe[1]);
+        close(err_pipe[1]);
+    }
+
+    if (pids.size() < stages.size()) {
+        // Stages already running would wait for input forever, or write into a closed pipe.
+        if (!pids.empty())
+            kill(-pids.front(), SIGKILL);
+        for (pid_t pid : pids)
+            while (waitpid(pid, nullptr, 0) == -1 && errno == EINTR) {}
+
+        if (capture) {
+            close(out_pipe[0]);
+            close(err_pipe[0]);
+        }
+        errno = spawn_errno;
+        return 0;
+    }
+
+    Watch* watch = new Watch();
+    watch->pids = pids;
+    watch->taskid = taskid;
+    watch->sink = sink;
+    watch->on_exit = on_exit;
+
+    for (const webdash::LaunchSpec& spec : stages)
+        watch->result.stages.push_back(webdash::StageResult { spec.command.GetText(), -1 });
+
+    webdash::RunReturn* ret = collect_output ? &watch->result : nullptr;
+    if (capture) {
+        watch->slots.push_back(std::unique_ptr<Slot>(new Slot { watch, out_pipe[0], webdash::PipeCapture(out_pipe[0], webdash::Stream::Stdout, ret, sink.get(), taskid) }));
+        watch->slots.push_back(std::unique_ptr<Slot>(new Slot { watch, err_pipe[0], webdash::PipeCapture(err_pipe[0], webdash::Stream::Stderr, ret, sink.get(), taskid) }));
+    }
+
+    vector<size_t> unwatched_stages;
+    for (size_t i = 0; i < pids.size(); ++i) {
+        const int pidfd = OpenPidFd(pids[i]);
+        if (pidfd >= 0)
+            watch->slots.push_back(std::unique_ptr<Slot>(new Slot { watch, pidfd, nullopt, i }));
+        else
+            unwatched_stages.push_back(i);
+    }
+
+    // The loop may finish slots (and the whole watch) while we are still registering.
+    // Our own reference keeps the watch alive until we are done with it.
+    watch->references = watch->slots.size() + 1;
+
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(_watches_mutex);
+        id = _next_id++;
+        watch->id = id;
+        _watches[id] = watch;
+
+        if (timeout.has_value())
+            _AddDeadline(std::chrono::steady_clock::now() + timeout.value(), id, DeadlineAction::Terminate);
+    }
+
+    vector<Slot*> slots;
+    for (auto& slot : watch->slots)
+        slots.push_back(slot.get());
+
+    for (Slot* slot : slots) {
+        epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.ptr = slot;
+
+        if (_epoll_fd < 0 || epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, slot->fd, &ev) < 0) {
+            MyWorld().Log(WebDash::LogType::ERR, "Supervisor: failed to watch " + taskid);
+            if (slot->capture.has_value())
+                _Close(slot);
+            else
+                _Reap(watch, slot->stage, true);
+        }
+    }
+
+    // No pidfd support (Linux < 5.3): helper threads wait for the stages instead.
+    for (size_t stage : unwatched_stages) {
+        watch->references++;
+        std::thread([this, watch, stage]() { _Reap(watch, stage, true); _Release(watch); }).detach();
+    }
+
+    _Release(watch);
+
+    return id;
+}
+
+void WebDashSupervisor::Terminate(uint64_t id) {
+    std::lock_guard<std::mutex> lock(_watches_mutex);
+
+    auto it = _watches.find(id);
+    if (it == _watches.end() || it->second->is_terminating)
+        return;
+
+    Watch* watch = it->second;
+    watch->is_terminating = true;
+
+    WEBDASH_LOG(WebDash::LogType::INFO, "Supervisor: terminating " + watch->taskid + " (pid " + to_string(watch->pids.front()) + ").");
+
+    kill(-watch->pids.front(), SIGTERM);
+    _AddDeadline(std::chrono::steady_clock::now() + kTerminateGracePeriod, id, DeadlineAction::Kill);
+}
+
+void WebDashSupervisor::_AddDeadline(std::chrono::steady_clock::time_point when, uint64_t id, DeadlineAction action) {
+    const bool is_earliest = _deadlines.empty() || when < _deadlines.begin()->first;
+
+    _deadlines.emplace(when, make_pair(id, action));
+
+    if (is_earliest)
+        _ArmTimer();
+}
+
+void WebDashSupervisor::_ArmTimer() {
+    itimerspec spec = {};
+
+    // All zero disarms the timer.
+    if (!_deadlines.empty()) {
+        // CLOCK_MONOTONIC is what std::chrono::steady_clock uses on Linux.
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(_deadlines.begin()->first.time_since_epoch()).count();
+        spec.it_value.tv_sec = ns / 1000000000;
+        spec.it_value.tv_nsec = ns % 1000000000;
+
+        if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+            spec.it_value.tv_nsec = 1;
+    }
+
+    timerfd_settime(_timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+void WebDashSupervisor::_OnTimer() {
+    uint64_t expirations;
+    if (read(_timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        perror("WebDashSupervisor!timerfd");
+
+    vector<uint64_t> timed_out;
+
+    {
+        std::lock_guard<std::mutex> lock(_watches_mutex);
+
+        const auto now = std::chrono::steady_clock::now();
+        while (!_deadlines.empty() && _deadlines.begin()->first <= now) {
+            const auto [id, action] = _deadlines.begin()->second;
+            _deadlines.erase(_deadlines.begin());
+
+            // Children that are gone leave stale deadlines behind.
+            auto it = _watches.find(id);
+            if (it == _watches.end())
+                continue;
+
+            if (action == DeadlineAction::Terminate) {
+                timed_out.push_back(id);
+            } else {
+                WEBDASH_LOG(WebDash::LogType::WARN, "Supervisor: killing " + it->second->taskid + " (pid " + to_string(it->second->pids.front()) + ").");
+                kill(-it->second->pids.front(), SIGKILL);
+            }
+        }
+
+        _ArmTimer();
+    }
+
+    for (uint64_t id : timed_out) {
+        MyWorld().Log(WebDash::LogType::ERR, "Supervisor: child " + to_string(id) + " exceeded its timeout.");
+        Terminate(id);
+    }
+}
+
+void WebDashSupervisor::_Loop() {
+    epoll_event events[kMaxEvents];
+
+    while (true) {
+        const int count = epoll_wait(_epoll_fd, events, kMaxEvents, -1);
+        if (count < 0) {
+            if (errno == EINTR)
+                continue;
+
+            perror("WebDashSupervisor!epoll_wait");
+            return;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            // Shutdown requested.
+            if (events[i].data.ptr == &_wakeup_fd)
+                return;
+
+            if (events[i].data.ptr == &_timer_fd) {
+                _OnTimer();
+                continue;
+            }
+
+            Slot* slot = static_cast<Slot*>(events[i].data.ptr);
+
+            // The pidfd becomes readable once the stage exited.
+            if (!slot->capture.has_value()) {
+                _Reap(slot->watch, slot->stage, false);
+                continue;
+            }
+
+            const auto status = slot->capture->Pump(kPumpBudget);
+            if (status == webdash::PipeCapture::Status::Open)
+                continue;
+
+            if (status == webdash::PipeCapture::Status::Error)
+                MyWorld().Log(WebDash::LogType::ERR, "Supervisor: failed reading the output of " + slot->watch->taskid);
+
+            _Close(slot);
+        }
+    }
+}
+
+void WebDashSupervisor::_Close(Slot* slot) {
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, slot->fd, nullptr);
+    close(slot->fd);
+
+    _Release(slot->watch);
+}
+
+void WebDashSupervisor::_Reap(Watch* watch, size_t stage, bool block) {
+    const pid_t pid = watch->pids[stage];
+
+    int status = 0;
+    pid_t wpid;
+    while ((wpid = waitpid(pid, &status, block ? 0 : WNOHANG)) == -1 && errno == EINTR) {}
+
+    // Spurious wake-up, the stage is still running.
+    if (wpid == 0)
+        return;
+
+    int return_code = wpid == pid && WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+
+    // A later stage stopped reading (e.g. `head`). Not a failure.
+    if (wpid == pid && WIFSIGNALED(status) && WTERMSIG(status) == SIGPIPE && stage + 1 < watch->pids.size())
+        return_code = 0;
+
+    watch->result.stages[stage].return_code = return_code;
+
+    for (auto& slot : watch->slots) {
+        if (!slot->capture.has_value() && slot->stage == stage) {
+            _Close(slot.get());
+            break;
+        }
+    }
+}
+
+void WebDashSupervisor::_Release(Watch* watch) {
+    if (--watch->references > 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(_watches_mutex);
+        _watches.erase(watch->id);
+    }
+
+    auto on_exit = std::move(watch->on_exit);
+    webdash::RunReturn result = std::move(watch->result);
+
+    // A failing stage fails the pipeline, even if later stages succeed.
+    for (const webdash::StageResult& stage : result.stages)
+        if (stage.return_code != 0)
+            result.return_code = stage.return_code;
+    delete watch;
+
+    if (on_exit)
+        on_exit(std::move(result));
+}
@@ -0,0 +1,93 @@
+#include "webdash-task-handle.hpp"
+using namespace std;
+
+
+webdash::TaskHandle::TaskHandle() : _state(std::make_shared<State>()) {
+}
+
+/* static */ webdash::TaskHandle webdash::TaskHandle::Completed(RunReturn ret) {
+    TaskHandle handle;
+    handle.Complete(ret);
+    return handle;
+}
+
+bool webdash::TaskHandle::Poll() const {
+    std::lock_guard<std::mutex> lock(_state->mutex);
+    return _state->is_done;
+}
+
+webdash::RunReturn webdash::TaskHandle::Wait() const {
+    std::unique_lock<std::mutex> lock(_state->mutex);
+    _state->cv.wait(lock, [&]() { return _state->is_done; });
+    return _state->result;
+}
+
+void webdash::TaskHandle::Cancel() const {
+    std::function<void()> canceller;
+
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        if (_state->is_done || _state->is_cancelled)
+            return;
+
+        _state->is_cancelled = true;
+        canceller = _state->canceller;
+    }
+
+    if (canceller)
+        canceller();
+}
+
+bool webdash::TaskHandle::IsCancelled() const {
+    std::lock_guard<std::mutex> lock(_state->mutex);
+    return _state->is_cancelled;
+}
+
+void webdash::TaskHandle::OnDone(std::function<void(const RunReturn&)> callback) const {
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        if (!_state->is_done) {
+            _state->callbacks.push_back(callback);
+            return;
+        }
+    }
+
+    callback(_state->result);
+}
+
+void webdash::TaskHandle::Complete(RunReturn ret) const {
+    vector<std::function<void(const RunReturn&)>> callbacks;
+
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        if (_state->is_done)
+            return;
+
+        _state->is_done = true;
+        _state->result = std::move(ret);
+        _state->canceller = nullptr;
+        callbacks.swap(_state->callbacks);
+    }
+
+    _state->cv.notify_all();
+
+    // The result is immutable from here on.
+    for (auto& callback : callbacks)
+        callback(_state->result);
+}
+
+void webdash::TaskHandle::SetCanceller(std::function<void()> canceller) const {
+    bool cancel_now = false;
+
+    {
+        std::lock_guard<std::mutex> lock(_state->mutex);
+        if (_state->is_done)
+            return;
+
+        _state->canceller = canceller;
+        cancel_now = _state->is_cancelled;
+    }
+
+    if (cancel_now)
+        canceller();
+}
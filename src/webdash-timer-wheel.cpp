@@ -0,0 +1,107 @@
+#include "webdash-timer-wheel.hpp"
+
+#include <algorithm>
+using namespace std;
+
+
+void webdash::TimerWheel::Schedule(uint64_t id, uint64_t tick) {
+    Cancel(id);
+
+    list<Timer> pending;
+    pending.push_back(Timer { id, min(max(tick, _now), kHorizon - 1) });
+    _Place(pending, pending.begin());
+}
+
+void webdash::TimerWheel::Cancel(uint64_t id) {
+    auto found = _index.find(id);
+    if (found == _index.end())
+        return;
+
+    const Location& location = found->second;
+    list<Timer>& slot = _slots[location.level][location.slot];
+    slot.erase(location.it);
+    if (slot.empty())
+        _occupied[location.level] &= ~(1ull << location.slot);
+
+    _index.erase(found);
+}
+
+vector<uint64_t> webdash::TimerWheel::Advance(uint64_t tick) {
+    vector<uint64_t> expired;
+    tick = max(tick, _now);
+
+    // Jump from expiry to expiry instead of ticking through the idle time in between.
+    while (true) {
+        const auto next = NextExpiry();
+        if (!next.has_value() || next.value() > tick)
+            break;
+
+        _SetNow(next.value());
+
+        const int slot = _GetSlot(_now, 0);
+        for (const Timer& timer : _slots[0][slot]) {
+            expired.push_back(timer.id);
+            _index.erase(timer.id);
+        }
+
+        _slots[0][slot].clear();
+        _occupied[0] &= ~(1ull << slot);
+    }
+
+    _SetNow(tick);
+
+    return expired;
+}
+
+std::optional<uint64_t> webdash::TimerWheel::NextExpiry() const {
+    for (int level = 0; level < kLevels; ++level) {
+        if (_occupied[level] == 0)
+            continue;
+
+        // Slots behind the current digit are empty: their timers would lie in the past.
+        const uint64_t ahead = _occupied[level] & (~0ull << _GetSlot(_now, level));
+        const int slot = __builtin_ctzll(ahead != 0 ? ahead : _occupied[level]);
+
+        // All timers of a level 0 slot expire at the same tick.
+        if (level == 0)
+            return (_now & ~(uint64_t)(kSlots - 1)) | slot;
+
+        uint64_t earliest = UINT64_MAX;
+        for (const Timer& timer : _slots[level][slot])
+            earliest = min(earliest, timer.expiry);
+
+        return earliest;
+    }
+
+    return nullopt;
+}
+
+void webdash::TimerWheel::_Place(list<Timer>& from, list<Timer>::iterator it) {
+    const uint64_t diff = it->expiry ^ _now;
+    const int level = diff == 0 ? 0 : min(kLevels - 1, (63 - __builtin_clzll(diff)) / kSlotBits);
+    const int slot = _GetSlot(it->expiry, level);
+
+    list<Timer>& target = _slots[level][slot];
+    target.splice(target.end(), from, it);
+    _occupied[level] |= 1ull << slot;
+
+    _index[it->id] = Location { level, slot, it };
+}
+
+void webdash::TimerWheel::_SetNow(uint64_t tick) {
+    _now = tick;
+
+    // Entering a slot of a higher level: its timers now differ from _now in lower digits only.
+    for (int level = kLevels - 1; level >= 1; --level) {
+        const int slot = _GetSlot(_now, level);
+        if (!(_occupied[level] & (1ull << slot)))
+            continue;
+
+        list<Timer> cascading;
+        cascading.splice(cascading.end(), _slots[level][slot]);
+        _occupied[level] &= ~(1ull << slot);
+
+        while (!cascading.empty())
+            _Place(cascading, cascading.begin());
+    }
+}
@@ -1,9 +1,11 @@
+#include "webdash-substitutions.hpp"
+
 #include <iostream>
 #include <string>
 #include <vector>
 using namespace std;
 
-string SubstituteKeywords(string src, string keyword, string replace_with) {
+string SubstituteKeywords(string src, const string& keyword, const string& replace_with) {
     size_t pos;
 
     while ((pos = src.find(keyword)) != string::npos) {
@@ -13,13 +15,9 @@ string SubstituteKeywords(string src, string keyword, string replace_with) {
     return src;
 }
 
-string ApplySubstitutions(string src, vector<pair<string, string>> substitutions) {
-    
-    for (auto& [key, value] : substitutions) {
-        src = SubstituteKeywords(src, key, value);
-    }
-
-    return src;
+string ApplySubstitutions(const string& src, const vector<pair<string, string>>& substitutions) {
+    // Callers substituting many texts should keep a webdash::Substitutions instead.
+    return webdash::Substitutions(substitutions).Apply(src);
 }
 
 string GetDirectoryOf(string full_fulename) {
@@ -0,0 +1,346 @@
+#include "webdash-worker-pool.hpp"
+#include "webdash-core.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+using namespace std;
+
+
+namespace {
+    // Time a worker gets to introduce itself.
+    constexpr int kHelloTimeoutSeconds = 5;
+}
+
+/* static */ WebDashWorkerPool& WebDashWorkerPool::Get() {
+    static WebDashWorkerPool pool;
+    return pool;
+}
+
+WebDashWorkerPool::~WebDashWorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto& worker : _workers) {
+            worker->is_connected = false;
+            shutdown(worker->fd, SHUT_RDWR);
+        }
+    }
+
+    for (auto& worker : _workers) {
+        if (worker->reader.joinable())
+            worker->reader.join();
+        close(worker->fd);
+    }
+}
+
+int WebDashWorkerPool::Connect(const vector<string>& addresses) {
+    for (const string& address : addresses) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_workers_by_address.count(address))
+                continue;
+        }
+
+        const int fd = webdash::ConnectTcp(address);
+        if (fd < 0) {
+            MyWorld().Log(WebDash::LogType::ERR, "Worker pool: unable to connect to " + address + ".");
+            continue;
+        }
+
+        // The worker introduces itself once we proved to know the secret.
+        if (!webdash::WriteFrame(fd, { { "type", "auth" }, { "secret", webdash::GetWorkerSecret() } })) {
+            MyWorld().Log(WebDash::LogType::ERR, "Worker pool: lost the connection to " + address + ".");
+            close(fd);
+            continue;
+        }
+
+        timeval timeout = { kHelloTimeoutSeconds, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        const auto hello = webdash::ReadFrame(fd);
+        timeout = { 0, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        if (!hello.has_value() || hello->header.value("type", "") != "hello" ||
+            hello->header.value("version", 0) != webdash::kWorkerProtocolVersion) {
+            MyWorld().Log(WebDash::LogType::ERR, "Worker pool: " + address + " is no compatible webdash-worker, or rejected our secret.");
+            close(fd);
+            continue;
+        }
+
+        auto worker = std::make_unique<Worker>();
+        worker->address = address;
+        worker->fd = fd;
+        worker->capacity = max(1, hello->header.value("capacity", 1));
+
+        vector<pair<Worker*, json>> requests;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            // Connected concurrently.
+            if (_workers_by_address.count(address)) {
+                close(fd);
+                continue;
+            }
+
+            Worker* raw = worker.get();
+            _workers.push_back(std::move(worker));
+            _workers_by_address[address] = raw;
+            raw->reader = std::thread(&WebDashWorkerPool::_Read, this, raw);
+
+            requests = _Dispatch();
+        }
+
+        _Send(requests);
+
+        WEBDASH_LOG(WebDash::LogType::INFO, "Worker pool: connected to " + address + " (capacity " + to_string(hello->header.value("capacity", 1)) + ").");
+    }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    int capacity = 0;
+    for (const auto& [address, worker] : _workers_by_address)
+        capacity += worker->capacity;
+
+    return capacity;
+}
+
+uint64_t WebDashWorkerPool::Launch(const vector<string>& workers,
+                                   const webdash::RemoteAction& action,
+                                   bool collect_output,
+                                   std::shared_ptr<webdash::OutputSink> sink,
+                                   const string& taskid,
+                                   std::function<void(webdash::RunReturn)> on_exit) {
+    Connect(workers);
+
+    json stages = json::array();
+    for (const webdash::Command& command : action.stages) {
+        const vector<string> argv(command.GetArgv(), command.GetArgv() + command.GetArgc());
+        stages.push_back({ { "argv", argv }, { "text", command.GetText() } });
+    }
+
+    auto run = std::make_unique<Run>();
+    run->collect_output = collect_output;
+    run->sink = sink;
+    run->taskid = taskid;
+    run->on_exit = on_exit;
+    run->request = {
+        { "type", "run" },
+        { "taskid", taskid },
+        { "stages", stages },
+        { "wdir", action.wdir.has_value() ? json(action.wdir.value()) : json(nullptr) },
+        { "env", action.environment },
+        { "timeout_ms", action.timeout.has_value() ? json(action.timeout.value().count()) : json(nullptr) }
+    };
+
+    uint64_t id;
+    vector<pair<Worker*, json>> requests;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        if (_workers_by_address.empty()) {
+            MyWorld().Log(WebDash::LogType::ERR, "Worker pool: no worker reachable for " + taskid + ".");
+            errno = ECONNREFUSED;
+            return 0;
+        }
+
+        id = _next_id++;
+        run->id = id;
+        run->request["id"] = id;
+
+        _runs[id] = std::move(run);
+        _pending.push_back(id);
+
+        requests = _Dispatch();
+    }
+
+    _Send(requests);
+
+    return id;
+}
+
+void WebDashWorkerPool::Terminate(uint64_t id) {
+    std::unique_ptr<Run> cancelled;
+    Worker* worker = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        auto it = _runs.find(id);
+        if (it == _runs.end())
+            return;
+
+        if (it->second->worker != nullptr) {
+            worker = it->second->worker;
+        } else {
+            // Not dispatched yet: nothing to tell a worker.
+            _pending.erase(std::find(_pending.begin(), _pending.end(), id));
+            cancelled = std::move(it->second);
+            _runs.erase(it);
+        }
+    }
+
+    if (cancelled) {
+        cancelled->result.return_code = -1;
+        if (cancelled->on_exit)
+            cancelled->on_exit(std::move(cancelled->result));
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(worker->write_mutex);
+    webdash::WriteFrame(worker->fd, { { "type", "cancel" }, { "id", id } });
+}
+
+void WebDashWorkerPool::_Read(Worker* worker) {
+    while (true) {
+        auto frame = webdash::ReadFrame(worker->fd);
+        if (!frame.has_value())
+            break;
+
+        const string type = frame->header.value("type", "");
+        const uint64_t id = frame->header.value("id", (uint64_t)0);
+
+        if (type == "output") {
+            // Runs of this worker are only ever removed by this thread.
+            Run* run = nullptr;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                auto it = _runs.find(id);
+                if (it != _runs.end() && it->second->worker == worker)
+                    run = it->second.get();
+            }
+
+            if (run != nullptr)
+                _OnOutput(run, static_cast<webdash::Stream>(frame->header.value("stream", 1)), frame->payload);
+        } else if (type == "exit") {
+            std::unique_ptr<Run> run;
+            vector<pair<Worker*, json>> requests;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                auto it = _runs.find(id);
+                if (it == _runs.end() || it->second->worker != worker)
+                    continue;
+
+                run = std::move(it->second);
+                _runs.erase(it);
+                worker->running--;
+
+                requests = _Dispatch();
+            }
+
+            _Send(requests);
+
+            run->result.return_code = frame->header.value("return_code", -1);
+            try {
+                for (const json& stage : frame->header.at("stages"))
+                    run->result.stages.push_back(webdash::StageResult { stage[0].get<std::string>(), stage[1].get<int>() });
+            } catch (...) {
+                WEBDASH_LOG(WebDash::LogType::WARN, "Worker pool: " + worker->address + " sent malformed stages.");
+            }
+
+            if (run->on_exit)
+                run->on_exit(std::move(run->result));
+        } else {
+            WEBDASH_LOG(WebDash::LogType::WARN, "Worker pool: ignoring message of type '" + type + "' from " + worker->address + ".");
+        }
+    }
+
+    // The connection broke: everything running there is lost.
+    vector<std::unique_ptr<Run>> failed;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        // Shutting down.
+        if (!worker->is_connected)
+            return;
+
+        worker->is_connected = false;
+        _workers_by_address.erase(worker->address);
+
+        for (auto it = _runs.begin(); it != _runs.end();) {
+            if (it->second->worker == worker) {
+                failed.push_back(std::move(it->second));
+                it = _runs.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        // Nobody left to run the waiting ones.
+        if (_workers_by_address.empty()) {
+            for (uint64_t id : _pending) {
+                failed.push_back(std::move(_runs[id]));
+                _runs.erase(id);
+            }
+            _pending.clear();
+        }
+    }
+
+    MyWorld().Log(WebDash::LogType::ERR, "Worker pool: lost connection to " + worker->address + ", " + to_string(failed.size()) + " action(s) failed.");
+
+    for (auto& run : failed) {
+        run->result.return_code = -1;
+        if (run->on_exit)
+            run->on_exit(std::move(run->result));
+    }
+}
+
+void WebDashWorkerPool::_OnOutput(Run* run, webdash::Stream stream, const string& data) {
+    if (run->collect_output) {
+        run->result.chunks.push_back(webdash::OutputChunk { stream, std::chrono::system_clock::now(), run->result.output.size(), data.size() });
+        run->result.output += data;
+    }
+
+    if (run->sink)
+        run->sink->Write(run->taskid, stream, data.data(), data.size());
+
+    // Like a local child inheriting our stdout/stderr.
+    if (!run->collect_output && !run->sink) {
+        const int fd = stream == webdash::Stream::Stdout ? STDOUT_FILENO : STDERR_FILENO;
+        for (size_t done = 0; done < data.size();) {
+            const ssize_t n = write(fd, data.data() + done, data.size() - done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            done += n;
+        }
+    }
+}
+
+vector<pair<WebDashWorkerPool::Worker*, json>> WebDashWorkerPool::_Dispatch() {
+    vector<pair<Worker*, json>> requests;
+
+    while (!_pending.empty()) {
+        Worker* best = nullptr;
+        for (const auto& [address, worker] : _workers_by_address) {
+            const int free = worker->capacity - worker->running;
+            if (free > 0 && (best == nullptr || free > best->capacity - best->running))
+                best = worker;
+        }
+
+        // Everybody is busy.
+        if (best == nullptr)
+            break;
+
+        Run* run = _runs[_pending.front()].get();
+        _pending.pop_front();
+
+        run->worker = best;
+        best->running++;
+        requests.emplace_back(best, run->request);
+    }
+
+    return requests;
+}
+
+void WebDashWorkerPool::_Send(const vector<pair<Worker*, json>>& requests) {
+    for (const auto& [worker, request] : requests) {
+        std::lock_guard<std::mutex> lock(worker->write_mutex);
+
+        // The reader notices the broken connection and fails the runs.
+        if (!webdash::WriteFrame(worker->fd, request))
+            shutdown(worker->fd, SHUT_RDWR);
+    }
+}
@@ -0,0 +1,669 @@
+#include "webdash-worker.hpp"
+#include "webdash-capture.hpp"
+#include "webdash-core.hpp"
+#include "webdash-process.hpp"
+#include "webdash-supervisor.hpp"
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <unordered_set>
+using namespace std;
+
+
+namespace {
+    // Relative to the myworld root, rather than GetPersistenteStoragePath(), which differs per program.
+    const string kSecretDirectory = "/app-persistent/data/webdash-worker";
+    const string kSecretFile = "worker.secret";
+
+    const char* const kLoopbackHost = "127.0.0.1";
+
+    // Bytes of randomness of a generated secret.
+    constexpr size_t kSecretSize = 32;
+
+    // Time and space a client gets to authenticate.
+    constexpr int kAuthTimeoutSeconds = 5;
+    constexpr uint32_t kMaxAuthFrameSize = 4096;
+
+    // Output a client may fall behind by before being disconnected.
+    constexpr size_t kMaxQueuedBytes = 64 << 20;
+
+    void PutUint32(char* out, uint32_t value) {
+        for (int i = 0; i < 4; ++i)
+            out[i] = (char)((value >> (24 - 8 * i)) & 0xff);
+    }
+
+    uint32_t GetUint32(const char* in) {
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i)
+            value = (value << 8) | (unsigned char)in[i];
+        return value;
+    }
+
+    bool ReadExactly(int fd, char* out, size_t len) {
+        while (len > 0) {
+            const ssize_t n = recv(fd, out, len, 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+
+            out += n;
+            len -= n;
+        }
+
+        return true;
+    }
+
+    string EncodeFrame(const json& header, const char* payload, size_t len) {
+        // Command lines and task ids are not necessarily valid UTF-8.
+        const string text = header.dump(-1, ' ', false, json::error_handler_t::replace);
+
+        string frame(8, '\0');
+        PutUint32(&frame[0], text.size());
+        PutUint32(&frame[4], len);
+        frame += text;
+        if (len > 0)
+            frame.append(payload, len);
+
+        return frame;
+    }
+
+    bool SendAll(int fd, const string& data) {
+        size_t done = 0;
+        while (done < data.size()) {
+            // A peer that went away must not kill us with SIGPIPE.
+            const ssize_t n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                return false;
+
+            done += n;
+        }
+
+        return true;
+    }
+
+    string Trim(const string& text) {
+        const size_t begin = text.find_first_not_of(" \t\r\n");
+        if (begin == string::npos)
+            return "";
+        return text.substr(begin, text.find_last_not_of(" \t\r\n") + 1 - begin);
+    }
+
+    // Takes the same time for all secrets of the same length.
+    bool IsSameSecret(const string& given, const string& expected) {
+        if (given.size() != expected.size())
+            return false;
+
+        unsigned char difference = 0;
+        for (size_t i = 0; i < given.size(); ++i)
+            difference |= (unsigned char)given[i] ^ (unsigned char)expected[i];
+        return difference == 0;
+    }
+}
+
+bool webdash::WriteFrame(int fd, const json& header, const char* payload, size_t len) {
+    return SendAll(fd, EncodeFrame(header, payload, len));
+}
+
+std::optional<webdash::Frame> webdash::ReadFrame(int fd, uint32_t max_header_size, uint32_t max_payload_size) {
+    char lengths[8];
+    if (!ReadExactly(fd, lengths, sizeof(lengths)))
+        return nullopt;
+
+    const uint32_t header_size = GetUint32(&lengths[0]);
+    const uint32_t payload_size = GetUint32(&lengths[4]);
+    if (header_size > max_header_size || payload_size > max_payload_size)
+        return nullopt;
+
+    string header(header_size, '\0');
+    Frame frame;
+    frame.payload.resize(payload_size);
+    if (!ReadExactly(fd, &header[0], header_size) || !ReadExactly(fd, &frame.payload[0], payload_size))
+        return nullopt;
+
+    frame.header = json::parse(header, nullptr, false);
+    if (frame.header.is_discarded() || !frame.header.is_object())
+        return nullopt;
+
+    return frame;
+}
+
+int webdash::ConnectTcp(const string& address) {
+    const size_t colon = address.rfind(':');
+    if (colon == string::npos)
+        return -1;
+
+    string host = address.substr(0, colon);
+    const string port = address.substr(colon + 1);
+
+    // [::1]:8080
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* found = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &found) != 0)
+        return -1;
+
+    int fd = -1;
+    for (addrinfo* candidate = found; candidate != nullptr; candidate = candidate->ai_next) {
+        fd = socket(candidate->ai_family, candidate->ai_socktype | SOCK_CLOEXEC, candidate->ai_protocol);
+        if (fd < 0)
+            continue;
+
+        if (connect(fd, candidate->ai_addr, candidate->ai_addrlen) == 0)
+            break;
+
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(found);
+
+    if (fd >= 0) {
+        // Frames are small and latency matters more than packet count.
+        const int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+
+    return fd;
+}
+
+string webdash::GetWorkerSecret() {
+    const char* from_environment = getenv("WEBDASH_WORKER_SECRET");
+    if (from_environment != nullptr && !Trim(from_environment).empty())
+        return Trim(from_environment);
+
+    const string directory = MyWorld().GetMyWorldRootDirectory() + kSecretDirectory;
+    std::error_code ec;
+    std::filesystem::create_directories(directory, ec);
+
+    const string path = directory + "/" + kSecretFile;
+
+    // Created exclusively, so that concurrent first uses agree on one secret. Readable by us only.
+    const int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd >= 0) {
+        unsigned char random[kSecretSize];
+        size_t filled = 0;
+        while (filled < sizeof(random)) {
+            const ssize_t n = getrandom(random + filled, sizeof(random) - filled, 0);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            filled += n;
+        }
+
+        string secret;
+        for (unsigned char byte : random) {
+            static const char kHex[] = "0123456789abcdef";
+            secret += kHex[byte >> 4];
+            secret += kHex[byte & 0xf];
+        }
+
+        const string line = secret + "\n";
+        const bool is_written = filled == sizeof(random) && write(fd, line.data(), line.size()) == (ssize_t)line.size();
+        close(fd);
+
+        if (!is_written) {
+            perror("webdash::GetWorkerSecret!write");
+            unlink(path.c_str());
+            return "";
+        }
+
+        WEBDASH_LOG(WebDash::LogType::INFO, "Worker: created a new secret in " + path + ".");
+        return secret;
+    }
+
+    ifstream in(path);
+    return Trim(string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()));
+}
+
+struct WebDashWorker::Connection {
+    Connection(int fd) : fd(fd) {}
+
+    // Closed only once nobody can write anymore, so the descriptor is never reused under our feet.
+    ~Connection() { close(fd); }
+
+    // Queues a frame for the writer; never blocks on the client, as it is called from the supervisor
+    // thread too. A client too far behind is disconnected. Returns false iff the frame is dropped.
+    bool Send(const json& header, const char* payload = nullptr, size_t len = 0) {
+        string frame = EncodeFrame(header, payload, len);
+
+        std::lock_guard<std::mutex> lock(write_mutex);
+        if (is_writer_stopped)
+            return false;
+
+        if (queued_bytes + frame.size() > kMaxQueuedBytes) {
+            MyWorld().Log(WebDash::LogType::ERR, "Worker: a client doesn't keep up with the output. Disconnecting it.");
+            is_writer_stopped = true;
+            shutdown(fd, SHUT_RDWR);
+            writable.notify_one();
+            return false;
+        }
+
+        queued_bytes += frame.size();
+        queued.push_back(std::move(frame));
+        writable.notify_one();
+        return true;
+    }
+
+    void StartWriter() {
+        writer = std::thread(&Connection::_Write, this);
+    }
+
+    // Drops what is still queued.
+    void StopWriter() {
+        {
+            std::lock_guard<std::mutex> lock(write_mutex);
+            is_writer_stopped = true;
+        }
+        writable.notify_one();
+
+        if (writer.joinable())
+            writer.join();
+    }
+
+    void _Write() {
+        std::unique_lock<std::mutex> lock(write_mutex);
+
+        while (true) {
+            writable.wait(lock, [&] { return is_writer_stopped || !queued.empty(); });
+            if (is_writer_stopped)
+                return;
+
+            // One send for everything queued meanwhile.
+            string data;
+            for (string& frame : queued)
+                data += frame;
+            queued.clear();
+            queued_bytes = 0;
+
+            lock.unlock();
+            const bool is_sent = SendAll(fd, data);
+            lock.lock();
+
+            if (!is_sent) {
+                is_writer_stopped = true;
+                shutdown(fd, SHUT_RDWR);
+                return;
+            }
+        }
+    }
+
+    const int fd;
+
+    // Guards the fields below, signalling {writable} when they change.
+    std::mutex write_mutex;
+    std::condition_variable writable;
+    deque<string> queued;
+    size_t queued_bytes = 0;
+    bool is_writer_stopped = false;
+
+    std::thread writer;
+
+    // Request id -> supervisor id of the actions in flight. 0 while queued or being launched.
+    unordered_map<uint64_t, uint64_t> children;
+
+    // Requests cancelled while they had no supervisor id yet.
+    unordered_set<uint64_t> cancelled;
+
+    bool is_closed = false;
+
+    std::mutex mutex;
+};
+
+WebDashWorker::WebDashWorker(int capacity) : _capacity(capacity) {
+    if (_capacity <= 0)
+        _capacity = max(1, (int)std::thread::hardware_concurrency());
+}
+
+bool WebDashWorker::Serve(const string& host, uint16_t port) {
+    _secret = webdash::GetWorkerSecret();
+    if (_secret.empty()) {
+        MyWorld().Log(WebDash::LogType::ERR, "Worker: no secret to authenticate clients with. Not serving.");
+        return false;
+    }
+
+    // Other machines reach us only if asked for explicitly.
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    addrinfo* found = nullptr;
+    if (getaddrinfo(host.empty() ? kLoopbackHost : host.c_str(), to_string(port).c_str(), &hints, &found) != 0 || found == nullptr) {
+        MyWorld().Log(WebDash::LogType::ERR, "Worker: unable to resolve " + host);
+        return false;
+    }
+
+    const int listen_fd = socket(found->ai_family, found->ai_socktype | SOCK_CLOEXEC, found->ai_protocol);
+    const int one = 1;
+    if (listen_fd >= 0)
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (listen_fd < 0 || ::bind(listen_fd, found->ai_addr, found->ai_addrlen) != 0 || listen(listen_fd, SOMAXCONN) != 0) {
+        perror("WebDashWorker::Serve!listen");
+        MyWorld().Log(WebDash::LogType::ERR, "Worker: unable to listen on " + host + ":" + to_string(port));
+        if (listen_fd >= 0)
+            close(listen_fd);
+        freeaddrinfo(found);
+        return false;
+    }
+
+    freeaddrinfo(found);
+
+    sockaddr_storage bound = {};
+    socklen_t bound_len = sizeof(bound);
+    if (getsockname(listen_fd, (sockaddr*)&bound, &bound_len) == 0)
+        _port = ntohs(bound.ss_family == AF_INET6 ? ((sockaddr_in6*)&bound)->sin6_port : ((sockaddr_in*)&bound)->sin_port);
+
+    _listen_fd = listen_fd;
+    WEBDASH_LOG(WebDash::LogType::INFO, "Worker: listening on port " + to_string(_port) + " with capacity " + to_string(_capacity) + ".");
+
+    while (!_is_stopped) {
+        const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (_is_stopped)
+                break;
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            // E.g. out of descriptors. Give clients a chance to go away.
+            perror("WebDashWorker::Serve!accept");
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        std::thread(&WebDashWorker::_Serve, this, std::make_shared<Connection>(fd)).detach();
+    }
+
+    _listen_fd = -1;
+    close(listen_fd);
+
+    return true;
+}
+
+void WebDashWorker::Stop() {
+    _is_stopped = true;
+
+    // Wakes up accept().
+    const int fd = _listen_fd;
+    if (fd >= 0)
+        shutdown(fd, SHUT_RDWR);
+}
+
+void WebDashWorker::_Serve(std::shared_ptr<Connection> connection) {
+    WEBDASH_LOG(WebDash::LogType::DEBUG, "Worker: client connected.");
+
+    if (!_Authenticate(*connection)) {
+        MyWorld().Log(WebDash::LogType::WARN, "Worker: rejected a client that failed to authenticate.");
+        shutdown(connection->fd, SHUT_RDWR);
+        return;
+    }
+
+    connection->StartWriter();
+    connection->Send({ { "type", "hello" }, { "version", webdash::kWorkerProtocolVersion }, { "capacity", _capacity } });
+
+    while (true) {
+        auto frame = webdash::ReadFrame(connection->fd);
+        if (!frame.has_value())
+            break;
+
+        const string type = frame->header.value("type", "");
+        if (type == "run") {
+            {
+                std::lock_guard<std::mutex> lock(connection->mutex);
+                connection->children[frame->header.value("id", (uint64_t)0)] = 0;
+            }
+
+            _Start(connection, std::move(frame->header));
+        } else if (type == "cancel") {
+            const uint64_t id = frame->header.value("id", (uint64_t)0);
+
+            bool was_pending = false;
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                for (auto it = _pending.begin(); it != _pending.end(); ++it) {
+                    if (it->first == connection && it->second.value("id", (uint64_t)0) == id) {
+                        _pending.erase(it);
+                        was_pending = true;
+                        break;
+                    }
+                }
+            }
+
+            uint64_t child = 0;
+            {
+                std::lock_guard<std::mutex> lock(connection->mutex);
+                auto it = connection->children.find(id);
+                if (was_pending) {
+                    connection->children.erase(id);
+                } else if (it != connection->children.end()) {
+                    child = it->second;
+
+                    // Being launched: _Launch() gives up or terminates it once spawned.
+                    if (child == 0)
+                        connection->cancelled.insert(id);
+                }
+            }
+
+            if (was_pending) {
+                connection->Send({ { "type", "exit" }, { "id", id }, { "return_code", -1 }, { "stages", json::array() } });
+                continue;
+            }
+
+            if (child != 0)
+                WebDashSupervisor::Get().Terminate(child);
+        } else {
+            WEBDASH_LOG(WebDash::LogType::WARN, "Worker: ignoring message of type '" + type + "'.");
+        }
+    }
+
+    WEBDASH_LOG(WebDash::LogType::DEBUG, "Worker: client disconnected.");
+
+    // Nobody is interested in the results anymore.
+    vector<uint64_t> children;
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        connection->is_closed = true;
+        for (const auto& [id, child] : connection->children)
+            if (child != 0)
+                children.push_back(child);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto it = _pending.begin(); it != _pending.end();) {
+            if (it->first == connection)
+                it = _pending.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    for (uint64_t child : children)
+        WebDashSupervisor::Get().Terminate(child);
+
+    connection->StopWriter();
+    shutdown(connection->fd, SHUT_RDWR);
+}
+
+bool WebDashWorker::_Authenticate(Connection& connection) {
+    timeval timeout = { kAuthTimeoutSeconds, 0 };
+    setsockopt(connection.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    const auto frame = webdash::ReadFrame(connection.fd, kMaxAuthFrameSize, 0);
+    timeout = { 0, 0 };
+    setsockopt(connection.fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    if (!frame.has_value() || frame->header.value("type", "") != "auth")
+        return false;
+
+    const auto secret = frame->header.find("secret");
+    return secret != frame->header.end() && secret->is_string() && IsSameSecret(secret->get<std::string>(), _secret);
+}
+
+void WebDashWorker::_Start(std::shared_ptr<Connection> connection, json request) {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_running >= _capacity) {
+            _pending.emplace_back(connection, std::move(request));
+            return;
+        }
+
+        _running++;
+    }
+
+    _Launch(connection, request);
+}
+
+void WebDashWorker::_Launch(std::shared_ptr<Connection> connection, const json& request) {
+    const uint64_t id = request.value("id", (uint64_t)0);
+
+    bool is_cancelled = false;
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        is_cancelled = connection->cancelled.erase(id) > 0;
+        if (is_cancelled)
+            connection->children.erase(id);
+        else
+            connection->children[id] = 0;
+    }
+
+    if (is_cancelled) {
+        connection->Send({ { "type", "exit" }, { "id", id }, { "return_code", -1 }, { "stages", json::array() } });
+        _OnExit();
+        return;
+    }
+
+    vector<webdash::LaunchSpec> stages;
+    string taskid;
+    std::optional<std::chrono::milliseconds> timeout;
+
+    try {
+        taskid = request.value("taskid", "");
+
+        const auto environment = webdash::Environment::Build(request.at("env").get<vector<pair<string, string>>>());
+
+        std::optional<string> wdir;
+        if (!request.at("wdir").is_null())
+            wdir = request.at("wdir").get<std::string>();
+
+        if (!request.at("timeout_ms").is_null())
+            timeout = std::chrono::milliseconds(request.at("timeout_ms").get<int64_t>());
+
+        for (const json& stage : request.at("stages")) {
+            webdash::LaunchSpec spec;
+            spec.command = webdash::Command::FromArgv(stage.at("argv").get<vector<string>>(), stage.at("text").get<std::string>());
+            spec.environment = environment;
+            spec.wdir = wdir;
+            stages.push_back(std::move(spec));
+        }
+    } catch (...) {
+        MyWorld().Log(WebDash::LogType::ERR, "Worker: malformed run request " + to_string(id) + ".");
+
+        {
+            std::lock_guard<std::mutex> lock(connection->mutex);
+            connection->children.erase(id);
+            connection->cancelled.erase(id);
+        }
+
+        connection->Send({ { "type", "exit" }, { "id", id }, { "return_code", -1 }, { "stages", json::array() } });
+        _OnExit();
+        return;
+    }
+
+    auto sink = std::make_shared<webdash::CallbackSink>([connection, id](const string&, webdash::Stream stream, const char* data, size_t len) {
+        connection->Send({ { "type", "output" }, { "id", id }, { "stream", (int)stream } }, data, len);
+    });
+
+    WEBDASH_LOG(WebDash::LogType::DEBUG, "Worker: running " + taskid + " for a client.");
+
+    // May complete right away, on this thread.
+    const uint64_t child = WebDashSupervisor::Get().Launch(std::move(stages), false, sink, taskid, timeout,
+        [this, connection, id](webdash::RunReturn ret) {
+            {
+                std::lock_guard<std::mutex> lock(connection->mutex);
+                connection->children.erase(id);
+                connection->cancelled.erase(id);
+            }
+
+            json stages = json::array();
+            for (const webdash::StageResult& stage : ret.stages)
+                stages.push_back({ stage.command, stage.return_code });
+
+            connection->Send({ { "type", "exit" }, { "id", id }, { "return_code", ret.return_code }, { "stages", stages } });
+            _OnExit();
+        });
+
+    if (child == 0) {
+        perror("WebDashWorker::_Launch!spawn");
+        MyWorld().Log(WebDash::LogType::ERR, "Worker: failed to spawn " + taskid + ".");
+
+        {
+            std::lock_guard<std::mutex> lock(connection->mutex);
+            connection->children.erase(id);
+            connection->cancelled.erase(id);
+        }
+
+        // Same as a local spawn failure.
+        connection->Send({ { "type", "exit" }, { "id", id }, { "return_code", 1 }, { "stages", json::array() } });
+        _OnExit();
+        return;
+    }
+
+    bool terminate_now = false;
+    {
+        std::lock_guard<std::mutex> lock(connection->mutex);
+        auto it = connection->children.find(id);
+        if (it != connection->children.end())
+            it->second = child;
+
+        // The client went away or cancelled while we were launching.
+        const bool is_cancelled_meanwhile = connection->cancelled.erase(id) > 0;
+        terminate_now = it != connection->children.end() && (connection->is_closed || is_cancelled_meanwhile);
+    }
+
+    if (terminate_now)
+        WebDashSupervisor::Get().Terminate(child);
+}
+
+void WebDashWorker::_OnExit() {
+    std::shared_ptr<Connection> connection;
+    json request;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_pending.empty()) {
+            _running--;
+            return;
+        }
+
+        // The slot passes on to the next action.
+        connection = std::move(_pending.front().first);
+        request = std::move(_pending.front().second);
+        _pending.pop_front();
+    }
+
+    _Launch(connection, request);
+}
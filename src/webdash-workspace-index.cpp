@@ -0,0 +1,413 @@
+#include "webdash-workspace-index.hpp"
+#include "webdash-config-image.hpp"
+#include "webdash-core.hpp"
+#include "webdash-fingerprint.hpp"
+#include "webdash-substitutions.hpp"
+#include "webdash-utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <nlohmann/json.hpp>
+using namespace std;
+using json = nlohmann::json;
+
+
+namespace {
+    const string kIndexFile = "workspace-index.bin";
+    const string kIgnoreFile = ".webdashignore";
+    const string kConfigFile = "webdash.config.json";
+
+    // "WDWI"
+    constexpr uint32_t kIndexMagic = 0x49574457;
+    constexpr uint32_t kIndexVersion = 2;
+
+    // Never part of the workspace's tasks; app-* hold data of webdash itself.
+    const vector<string> kSkippedDirectories = { "app-temporary", "app-persistent", ".git" };
+
+    int64_t GetMtimeNs(const struct stat& st) {
+        return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    }
+
+    string Join(const string& relative, const string& name) {
+        return relative.empty() ? name : relative + "/" + name;
+    }
+
+    bool IsIgnored(const vector<string>& patterns, const string& relative, const string& name) {
+        if (std::find(kSkippedDirectories.begin(), kSkippedDirectories.end(), name) != kSkippedDirectories.end())
+            return true;
+
+        for (const string& pattern : patterns) {
+            const bool is_path_pattern = pattern.find('/') != string::npos;
+            if (is_path_pattern ? fnmatch(pattern.c_str(), relative.c_str(), FNM_PATHNAME) == 0
+                                : fnmatch(pattern.c_str(), name.c_str(), 0) == 0)
+                return true;
+        }
+
+        return false;
+    }
+
+    // Task names of the config at {path}, substituted like WebDashConfig does.
+    vector<string> ReadTaskNames(const string& path, const webdash::Substitutions& substitutions) {
+        vector<string> names;
+
+        json config;
+        try {
+            ifstream in(path);
+            in >> config;
+        } catch (...) {
+            WEBDASH_LOG(WebDash::LogType::WARN, "Workspace index: unable to parse " + path + ". Skipped.");
+            return names;
+        }
+
+        // Comes last in WebDashConfig::GetAllDefinitions.
+        const string this_dir = GetDirectoryOf(path);
+
+        try {
+            for (const json& cmd : config.at("commands")) {
+                if (cmd.contains("name") && cmd["name"].is_string())
+                    names.push_back(SubstituteKeywords(substitutions.Apply(cmd["name"].get<std::string>()), "$.thisDir()", this_dir));
+            }
+        } catch (...) {
+            WEBDASH_LOG(WebDash::LogType::WARN, "Workspace index: no 'commands' in " + path + ".");
+        }
+
+        return names;
+    }
+
+    // True iff the characters of {query} appear in {text} in order.
+    bool IsSubsequence(const string& query, const string& text) {
+        size_t at = 0;
+        for (char c : text) {
+            if (at < query.size() && query[at] == c)
+                at++;
+        }
+        return at == query.size();
+    }
+}
+
+/* static */ WebDashWorkspaceIndex& WebDashWorkspaceIndex::Get() {
+    static WebDashWorkspaceIndex index;
+    return index;
+}
+
+void WebDashWorkspaceIndex::Refresh() {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _Load();
+
+    // As WebDashConfig::GetAllDefinitions, except for $.thisDir().
+    vector<pair<string, string>> defs = MyWorld().GetCustomDefinitions(false);
+    const auto core = MyWorld().GetCoreDefinitions();
+    defs.insert(defs.end(), core.begin(), core.end());
+    const webdash::Substitutions substitutions(defs);
+
+    // Task names are substituted with the definitions: all of them are read anew once these changed.
+    uint64_t definitions_hash = webdash::kFnv1aOffsetBasis;
+    for (const auto& [key, value] : defs)
+        definitions_hash = webdash::Fnv1a(key + '\0' + value + '\0', definitions_hash);
+    const bool is_definitions_changed = definitions_hash != _definitions_hash;
+
+    // Only read while walking.
+    const unordered_map<string, Directory>& previous = _directories;
+
+    const auto scan = [&](const string& relative, size_t& listed, size_t& parsed) -> std::optional<Directory> {
+        const string path = relative.empty() ? _root : _root + "/" + relative;
+
+        // Vanished meanwhile.
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+            return nullopt;
+
+        auto it = previous.find(relative);
+        const Directory* old = (it != previous.end()) ? &it->second : nullptr;
+
+        Directory dir;
+        dir.mtime = GetMtimeNs(st);
+
+        // Adding, removing or renaming entries changes the mtime of a directory, editing files does not.
+        bool may_have_config;
+        if (old != nullptr && old->mtime == dir.mtime) {
+            dir.subdirectories = old->subdirectories;
+            may_have_config = old->has_config;
+        } else {
+            listed++;
+            may_have_config = false;
+
+            DIR* handle = opendir(path.c_str());
+            if (handle == nullptr) {
+                WEBDASH_LOG(WebDash::LogType::WARN, "Workspace index: unable to list " + path + ".");
+                return dir;
+            }
+
+            while (const dirent* entry = readdir(handle)) {
+                const string name = entry->d_name;
+                if (name == "." || name == "..")
+                    continue;
+
+                if (name == kConfigFile)
+                    may_have_config = true;
+
+                // Symbolic links are not followed, so there are no cycles.
+                bool is_directory = entry->d_type == DT_DIR;
+                if (entry->d_type == DT_UNKNOWN) {
+                    struct stat entry_st;
+                    is_directory = lstat((path + "/" + name).c_str(), &entry_st) == 0 && S_ISDIR(entry_st.st_mode);
+                }
+
+                if (is_directory && !IsIgnored(_ignore_patterns, Join(relative, name), name))
+                    dir.subdirectories.push_back(name);
+            }
+
+            closedir(handle);
+            std::sort(dir.subdirectories.begin(), dir.subdirectories.end());
+        }
+
+        struct stat config_st;
+        const string config_path = path + "/" + kConfigFile;
+        if (may_have_config && stat(config_path.c_str(), &config_st) == 0 && S_ISREG(config_st.st_mode)) {
+            dir.has_config = true;
+            dir.config_mtime = GetMtimeNs(config_st);
+            dir.config_size = config_st.st_size;
+
+            if (old != nullptr && old->has_config && old->config_mtime == dir.config_mtime && old->config_size == dir.config_size &&
+                !is_definitions_changed) {
+                dir.tasks = old->tasks;
+            } else {
+                parsed++;
+                dir.tasks = ReadTaskNames(config_path, substitutions);
+            }
+        }
+
+        return dir;
+    };
+
+    unordered_map<string, Directory> current;
+    deque<string> queue = { "" };
+    size_t busy = 0;
+    size_t listed = 0;
+    size_t parsed = 0;
+    std::mutex queue_mutex;
+    std::condition_variable queue_changed;
+
+    const auto walk = [&]() {
+        size_t my_listed = 0;
+        size_t my_parsed = 0;
+
+        while (true) {
+            string relative;
+            {
+                std::unique_lock<std::mutex> queue_lock(queue_mutex);
+                queue_changed.wait(queue_lock, [&]() { return !queue.empty() || busy == 0; });
+
+                // Nothing queued and nobody left to queue more.
+                if (queue.empty())
+                    break;
+
+                relative = std::move(queue.front());
+                queue.pop_front();
+                busy++;
+            }
+
+            auto dir = scan(relative, my_listed, my_parsed);
+
+            std::lock_guard<std::mutex> queue_lock(queue_mutex);
+            if (dir.has_value()) {
+                for (const string& name : dir->subdirectories)
+                    queue.push_back(Join(relative, name));
+                current[relative] = std::move(dir.value());
+            }
+            busy--;
+            queue_changed.notify_all();
+        }
+
+        std::lock_guard<std::mutex> queue_lock(queue_mutex);
+        listed += my_listed;
+        parsed += my_parsed;
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+
+    vector<std::thread> threads;
+    const unsigned thread_count = max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 1; i < thread_count; ++i)
+        threads.emplace_back(walk);
+    walk();
+    for (auto& thread : threads)
+        thread.join();
+
+    _directories = std::move(current);
+    _definitions_hash = definitions_hash;
+    _is_refreshed = true;
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    WEBDASH_LOG(WebDash::LogType::DEBUG, "Workspace index: " + to_string(_directories.size()) + " directories, " +
+                                         to_string(listed) + " listed, " + to_string(parsed) + " config(s) parsed, " +
+                                         to_string(elapsed.count()) + " ms.");
+
+    _Save();
+}
+
+vector<string> WebDashWorkspaceIndex::GetTasks() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_is_refreshed) {
+            vector<string> ret;
+            for (const auto& [relative, dir] : _directories) {
+                for (const string& task : dir.tasks)
+                    ret.push_back(Join(relative, kConfigFile) + ":" + task);
+            }
+
+            std::sort(ret.begin(), ret.end());
+            return ret;
+        }
+    }
+
+    Refresh();
+    return GetTasks();
+}
+
+vector<string> WebDashWorkspaceIndex::Find(const string& query) {
+    // Lower rank is better.
+    vector<pair<int, string>> matches;
+    for (const string& entry : GetTasks()) {
+        const string name = entry.substr(entry.rfind(':') + 1);
+
+        int rank;
+        if (name == query)
+            rank = 0;
+        else if (name.compare(0, query.size(), query) == 0)
+            rank = 1;
+        else if (entry.find(query) != string::npos)
+            rank = 2;
+        else if (IsSubsequence(query, entry))
+            rank = 3;
+        else
+            continue;
+
+        matches.emplace_back(rank, entry);
+    }
+
+    std::stable_sort(matches.begin(), matches.end(), [](const auto& a, const auto& b) {
+        if (a.first != b.first)
+            return a.first < b.first;
+        return a.second.size() < b.second.size();
+    });
+
+    vector<string> ret;
+    ret.reserve(matches.size());
+    for (auto& [rank, entry] : matches)
+        ret.push_back(std::move(entry));
+
+    return ret;
+}
+
+void WebDashWorkspaceIndex::_Load() {
+    if (_is_loaded)
+        return;
+
+    _is_loaded = true;
+    _root = MyWorld().GetMyWorldRootDirectory();
+
+    {
+        ifstream in(_root + "/" + kIgnoreFile);
+        string line;
+        while (getline(in, line)) {
+            line.erase(0, line.find_first_not_of(" \t"));
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (line.empty() || line[0] == '#')
+                continue;
+
+            // "dir/" means the same as "dir".
+            if (line.size() > 1 && line.back() == '/')
+                line.pop_back();
+            _ignore_patterns.push_back(line);
+        }
+    }
+
+    const string path = (MyWorld().GetPersistenteStoragePath() / kIndexFile).string();
+    ifstream in(path, ios::binary);
+    if (!in)
+        return;
+
+    const string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    try {
+        webdash::ImageReader reader(data.data(), data.size());
+
+        if (reader.GetU32() != kIndexMagic || reader.GetU32() != kIndexVersion)
+            throw std::invalid_argument("version");
+
+        // Directories were filtered with the patterns of then.
+        if (reader.GetString() != _root || reader.GetStrings() != _ignore_patterns)
+            throw std::invalid_argument("root or ignore patterns changed");
+
+        // Checked by Refresh(), which has the definitions at hand.
+        _definitions_hash = reader.GetU64();
+
+        const uint64_t count = reader.GetU64();
+        for (uint64_t i = 0; i < count; ++i) {
+            const string relative = reader.GetString();
+
+            Directory& dir = _directories[relative];
+            dir.mtime = reader.GetU64();
+            dir.subdirectories = reader.GetStrings();
+            dir.has_config = reader.GetBool();
+            dir.config_mtime = reader.GetU64();
+            dir.config_size = reader.GetU64();
+            dir.tasks = reader.GetStrings();
+        }
+    } catch (const std::exception& e) {
+        WEBDASH_LOG(WebDash::LogType::DEBUG, "Workspace index: not using " + path + ": " + e.what());
+        _directories.clear();
+        _definitions_hash = 0;
+    }
+}
+
+void WebDashWorkspaceIndex::_Save() const {
+    webdash::ImageWriter writer;
+    writer.PutU32(kIndexMagic);
+    writer.PutU32(kIndexVersion);
+    writer.PutString(_root);
+    writer.PutStrings(_ignore_patterns);
+    writer.PutU64(_definitions_hash);
+
+    writer.PutU64(_directories.size());
+    for (const auto& [relative, dir] : _directories) {
+        writer.PutString(relative);
+        writer.PutU64(dir.mtime);
+        writer.PutStrings(dir.subdirectories);
+        writer.PutBool(dir.has_config);
+        writer.PutU64(dir.config_mtime);
+        writer.PutU64(dir.config_size);
+        writer.PutStrings(dir.tasks);
+    }
+
+    // Written aside and renamed into place, so that concurrent readers see either version.
+    const string path = (MyWorld().GetPersistenteStoragePath() / kIndexFile).string();
+    const string staging = path + ".tmp-" + to_string(getpid());
+    {
+        ofstream out(staging, ios::binary | ios::trunc);
+        out << writer.GetData();
+        out.close();
+
+        if (!out) {
+            MyWorld().Log(WebDash::LogType::ERR, "Workspace index: unable to write " + staging);
+            unlink(staging.c_str());
+            return;
+        }
+    }
+
+    if (rename(staging.c_str(), path.c_str()) != 0) {
+        perror("WebDashWorkspaceIndex::_Save!rename");
+        unlink(staging.c_str());
+    }
+}
@@ -0,0 +1,223 @@
+#include "webdash-config.hpp"
+#include "webdash-core.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+const string _WEBDASH_PROJECT_NAME_ = "webdash-executor-test";
+
+namespace {
+    // A hanging run is a failure, not a stuck ctest.
+    constexpr int kTimeoutSeconds = 30;
+
+    int failures = 0;
+
+    void Check(bool condition, const string& what) {
+        if (!condition) {
+            cerr << "FAILED: " << what << endl;
+            failures++;
+        }
+    }
+
+    void WriteFile(const string& path, const string& data) {
+        ofstream out(path, ios::binary | ios::trunc);
+        out << data;
+    }
+
+    // A dependency that finished before its dependent starts (here: skipped as up to date, and
+    // a root task of the same run) is shared, and must not leave the dependent waiting.
+    void TestSharedCompletedDependency(const string& root) {
+        WriteFile(root + "/in.txt", "in");
+        WriteFile(root + "/webdash.config.json", R"({
+            "commands": [
+                {
+                    "name": "build",
+                    "wdir": ")" + root + R"(",
+                    "inputs": [ "in.txt" ],
+                    "outputs": [ "out.txt" ],
+                    "action": "cp in.txt out.txt"
+                },
+                {
+                    "name": "all",
+                    "dependencies": [ ":build" ],
+                    "action": "true"
+                }
+            ]
+        })");
+
+        webdash::RunConfig config;
+        config.redirect_output_to_str = true;
+
+        for (int run = 0; run < 2; ++run) {
+            WebDashConfig webdash_config(root + "/webdash.config.json");
+            const auto results = webdash_config.Run("", config);
+
+            Check(results.size() == 2, "run " + to_string(run) + ": one result per task");
+            for (const auto& result : results)
+                Check(result.return_code == 0, "run " + to_string(run) + ": tasks succeed");
+        }
+    }
+
+    // The action cache holds what the actions of a task produced, not the output of its dependencies,
+    // and its output is replayed whenever the actions are skipped.
+    void TestActionCacheExcludesDependencies(const string& root) {
+        WriteFile(root + "/in.txt", "a");
+        WriteFile(root + "/webdash.config.json", R"({
+            "commands": [
+                {
+                    "name": "dep",
+                    "action": "echo dep"
+                },
+                {
+                    "name": "cached",
+                    "wdir": ")" + root + R"(",
+                    "dependencies": [ ":dep" ],
+                    "inputs": [ "in.txt" ],
+                    "outputs": [ "out.txt" ],
+                    "cache": true,
+                    "action": "sh -c 'cp in.txt out.txt && echo c'"
+                }
+            ]
+        })");
+
+        webdash::RunConfig config;
+        config.redirect_output_to_str = true;
+
+        auto run = [&](const string& input, const string& what) {
+            WriteFile(root + "/in.txt", input);
+
+            WebDashConfig webdash_config(root + "/webdash.config.json");
+            const auto results = webdash_config.Run("cached", config);
+
+            Check(results.size() == 1 && results[0].return_code == 0, what + ": succeeds");
+            if (!results.empty())
+                Check(results[0].GetStream(webdash::Stream::Stdout) == "dep\nc\n", what + ": output is \"dep\\nc\\n\", got \"" + results[0].output + "\"");
+        };
+
+        run("a", "first run");
+        run("b", "changed input");
+        run("a", "restored from the cache");
+        run("a", "up to date");
+    }
+
+    // Concurrent executors (as the scheduler starts them) share the run of a common dependency.
+    void TestConcurrentRunsShareDependency(const string& root) {
+        WriteFile(root + "/runs.txt", "");
+        WriteFile(root + "/webdash.config.json", R"({
+            "commands": [
+                {
+                    "name": "common",
+                    "wdir": ")" + root + R"(",
+                    "action": "sh -c 'echo run >> runs.txt; sleep 0.5; echo common'"
+                },
+                {
+                    "name": "a",
+                    "dependencies": [ ":common" ],
+                    "action": "true"
+                },
+                {
+                    "name": "b",
+                    "dependencies": [ ":common" ],
+                    "action": "true"
+                }
+            ]
+        })");
+
+        webdash::RunConfig config;
+        config.redirect_output_to_str = true;
+
+        WebDashConfig webdash_config(root + "/webdash.config.json");
+
+        vector<webdash::RunReturn> results_a;
+        std::thread other([&]() { results_a = webdash_config.Run("a", config); });
+        const auto results_b = webdash_config.Run("b", config);
+        other.join();
+
+        ifstream runs(root + "/runs.txt");
+        const string executions((std::istreambuf_iterator<char>(runs)), std::istreambuf_iterator<char>());
+        Check(executions == "run\n", "the common dependency runs once, got \"" + executions + "\"");
+
+        for (const auto& results : { results_a, results_b }) {
+            Check(results.size() == 1 && results[0].return_code == 0, "concurrent runs succeed");
+            if (!results.empty())
+                Check(results[0].GetStream(webdash::Stream::Stdout) == "common\n", "both runs get the output of the common dependency");
+        }
+    }
+
+    // Once a step of a fail-fast task failed, none of its later actions starts.
+    void TestFailFastStopsActions(const string& root) {
+        WriteFile(root + "/webdash.config.json", R"({
+            "commands": [
+                {
+                    "name": "failing",
+                    "wdir": ")" + root + R"(",
+                    "fail-fast": true,
+                    "actions": [ "false", "sh -c 'trap : TERM; touch marker.txt'" ]
+                }
+            ]
+        })");
+
+        webdash::RunConfig config;
+        config.redirect_output_to_str = true;
+        config.jobs = 4;
+
+        for (int run = 0; run < 20; ++run) {
+            std::filesystem::remove(root + "/marker.txt");
+
+            WebDashConfig webdash_config(root + "/webdash.config.json");
+            const auto results = webdash_config.Run("failing", config);
+
+            Check(results.size() == 1 && results[0].return_code != 0, "run " + to_string(run) + ": the fail-fast task fails");
+            Check(!std::filesystem::exists(root + "/marker.txt"), "run " + to_string(run) + ": the action after the failure does not run");
+        }
+    }
+}
+
+int main() {
+    char root_template[] = "/tmp/webdash-executor-test-XXXXXX";
+    const char* root = mkdtemp(root_template);
+    if (root == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    // The root is looked up from the working directory on first use of MyWorld(), so that all
+    // state (action cache, run state, logs) stays in the temporary directory.
+    WriteFile(string(root) + "/definitions.json", R"({ "myworld": { "rootDir": "this" } })");
+    if (chdir(root) != 0) {
+        perror("chdir");
+        return 1;
+    }
+
+    if (MyWorld().GetMyWorldRootDirectory() != root) {
+        cerr << "FAILED: the root is not " << root << endl;
+        return 1;
+    }
+
+    std::thread([]() {
+        std::this_thread::sleep_for(std::chrono::seconds(kTimeoutSeconds));
+        cerr << "FAILED: timed out" << endl;
+        _exit(1);
+    }).detach();
+
+    TestSharedCompletedDependency(root);
+    TestActionCacheExcludesDependencies(root);
+    TestConcurrentRunsShareDependency(root);
+    TestFailFastStopsActions(root);
+
+    std::filesystem::remove_all(root);
+
+    if (failures == 0)
+        cout << "All tests passed." << endl;
+
+    return failures == 0 ? 0 : 1;
+}
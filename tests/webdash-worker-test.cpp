@@ -0,0 +1,182 @@
+#include "webdash-capture.hpp"
+#include "webdash-core.hpp"
+#include "webdash-worker-pool.hpp"
+#include "webdash-worker.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+
+using namespace std;
+
+const string _WEBDASH_PROJECT_NAME_ = "webdash-worker-test";
+
+/**
+ *
+ * Two workers on loopback in this process, driven through the WebDashWorkerPool.
+ *
+ * */
+namespace {
+    // A hanging run is a failure, not a stuck ctest.
+    constexpr int kTimeoutSeconds = 60;
+
+    int failures = 0;
+
+    void Check(bool condition, const string& what) {
+        if (!condition) {
+            cerr << "FAILED: " << what << endl;
+            failures++;
+        }
+    }
+
+    double SecondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // An action running {script} with sh, whose result becomes available through the returned future.
+    struct Action {
+        uint64_t id = 0;
+        std::shared_ptr<std::promise<webdash::RunReturn>> done = std::make_shared<std::promise<webdash::RunReturn>>();
+        std::future<webdash::RunReturn> result = done->get_future();
+    };
+
+    Action Launch(const vector<string>& workers, const string& script, std::shared_ptr<webdash::OutputSink> sink = nullptr) {
+        webdash::RemoteAction remote;
+        remote.stages.push_back(webdash::Command::FromArgv({ "sh", "-c", script }, "sh -c '" + script + "'"));
+
+        Action action;
+        auto done = action.done;
+        action.id = WebDashWorkerPool::Get().Launch(workers, remote, sink == nullptr, sink, "test",
+            [done](webdash::RunReturn ret) { done->set_value(std::move(ret)); });
+
+        return action;
+    }
+
+    // Workers enqueue beyond their capacity, so running 3 at once needs both of them.
+    void TestDispatchByCapacity(const vector<string>& workers) {
+        const auto start = std::chrono::steady_clock::now();
+
+        vector<Action> actions;
+        for (int i = 0; i < 3; ++i)
+            actions.push_back(Launch(workers, "sleep 1; echo " + to_string(i)));
+
+        for (size_t i = 0; i < actions.size(); ++i) {
+            Check(actions[i].id != 0, "action " + to_string(i) + " is launched");
+            const auto ret = actions[i].result.get();
+            Check(ret.return_code == 0, "action " + to_string(i) + " succeeds");
+            Check(ret.output == to_string(i) + "\n", "action " + to_string(i) + " returns its output, got \"" + ret.output + "\"");
+        }
+
+        const double seconds = SecondsSince(start);
+        Check(seconds < 1.8, "3 actions run at once on workers of capacity 1 and 2, took " + to_string(seconds) + " s");
+    }
+
+    // Output arrives while the action runs, not only once it exited.
+    void TestStreamedOutput(const vector<string>& workers) {
+        const auto start = std::chrono::steady_clock::now();
+
+        auto first_output = std::make_shared<std::promise<double>>();
+        auto is_first = std::make_shared<bool>(true);
+        auto sink = std::make_shared<webdash::CallbackSink>([=](const string&, webdash::Stream, const char*, size_t) {
+            if (*is_first) {
+                *is_first = false;
+                first_output->set_value(SecondsSince(start));
+            }
+        });
+
+        Action action = Launch(workers, "echo first; sleep 1; echo second", sink);
+        const double first_output_seconds = first_output->get_future().get();
+        const auto ret = action.result.get();
+        const double exit_seconds = SecondsSince(start);
+
+        Check(ret.return_code == 0, "the streaming action succeeds");
+        Check(exit_seconds - first_output_seconds > 0.5, "output is streamed before the action exits");
+    }
+
+    // Cancelled right away (likely while the worker is launching it) and while running.
+    void TestCancel(const vector<string>& workers, const string& root) {
+        for (const bool is_immediate : { true, false }) {
+            const string what = is_immediate ? "cancelled right away" : "cancelled while running";
+            const string marker = root + "/not-cancelled";
+            std::filesystem::remove(marker);
+
+            const auto start = std::chrono::steady_clock::now();
+            Action action = Launch(workers, "sleep 3; touch " + marker);
+
+            if (!is_immediate)
+                std::this_thread::sleep_for(std::chrono::milliseconds(300));
+            WebDashWorkerPool::Get().Terminate(action.id);
+
+            const auto ret = action.result.get();
+            Check(ret.return_code != 0, what + ": the action fails");
+            Check(SecondsSince(start) < 2.5, what + ": the action is stopped");
+
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            Check(!std::filesystem::exists(marker), what + ": the action does not run to completion");
+        }
+    }
+}
+
+int main() {
+    char root_template[] = "/tmp/webdash-worker-test-XXXXXX";
+    const char* root = mkdtemp(root_template);
+    if (root == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    // The root, and with it the secret file, is looked up from the working directory.
+    ofstream(string(root) + "/definitions.json") << R"({ "myworld": { "rootDir": "this" } })";
+    if (chdir(root) != 0) {
+        perror("chdir");
+        return 1;
+    }
+
+    if (MyWorld().GetMyWorldRootDirectory() != root) {
+        cerr << "FAILED: the root is not " << root << endl;
+        return 1;
+    }
+
+    std::thread([]() {
+        std::this_thread::sleep_for(std::chrono::seconds(kTimeoutSeconds));
+        cerr << "FAILED: timed out" << endl;
+        _exit(1);
+    }).detach();
+
+    WebDashWorker worker_a(1);
+    WebDashWorker worker_b(2);
+    std::thread serve_a([&]() { Check(worker_a.Serve("", 0), "worker a serves"); });
+    std::thread serve_b([&]() { Check(worker_b.Serve("", 0), "worker b serves"); });
+
+    while (worker_a.GetPort() == 0 || worker_b.GetPort() == 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    const vector<string> workers = { "127.0.0.1:" + to_string(worker_a.GetPort()), "127.0.0.1:" + to_string(worker_b.GetPort()) };
+
+    const int capacity = WebDashWorkerPool::Get().Connect(workers);
+    Check(capacity == 3, "the pool connects to both workers, capacity " + to_string(capacity));
+
+    if (capacity > 0) {
+        TestDispatchByCapacity(workers);
+        TestStreamedOutput(workers);
+        TestCancel(workers, root);
+    }
+
+    worker_a.Stop();
+    worker_b.Stop();
+    serve_a.join();
+    serve_b.join();
+
+    std::filesystem::remove_all(root);
+
+    if (failures == 0)
+        cout << "All tests passed." << endl;
+
+    return failures == 0 ? 0 : 1;
+}